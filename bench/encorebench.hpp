@@ -20,7 +20,7 @@ namespace cmdline = deepsea::cmdline;
   
 void initialize(int argc, char** argv) {
   encore::initialize_runtime(argc, argv);
-  cilk_set_nb_cores(cmdline::parse_or_default("proc", 1));
+  cilk_set_nb_cores(encore::machine::get_nb_workers());
 }
 
 void trigger_cilk() {
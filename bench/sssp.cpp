@@ -0,0 +1,65 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "encorebench.hpp"
+#include "sssp.hpp"
+#include "graphio.hpp"
+
+namespace pbbs {
+
+void benchmark(std::string infile) {
+  graph::graph<int> g = read_from_file<graph::graph<int>>(infile);
+  int source = deepsea::cmdline::parse_or_default("source", 0);
+  int delta = std::max(1, deepsea::cmdline::parse_or_default("delta", 32));
+  encorebench::sssp_max_weight = std::max(1, deepsea::cmdline::parse_or_default("max_weight", encorebench::sssp_max_weight));
+  std::vector<int> dist(g.n);
+  deepsea::cmdline::dispatcher d;
+  d.add("encore", [&] {
+    std::vector<std::atomic<int>> adist(g.n);
+    encore::launch_interpreter<encorebench::sssp>(source, g, delta, adist.data());
+    for (int i = 0; i < g.n; i++) {
+      dist[i] = adist[i].load();
+    }
+  });
+  d.add("dijkstra", [&] {
+    encorebench::run_and_report_elapsed_time([&] {
+      encorebench::sssp_dijkstra(source, g, dist.data());
+    });
+  });
+  d.dispatch("algorithm");
+  long nb_visited = 0;
+  int max_dist = 0;
+  for (int i = 0; i < g.n; i++) {
+    if (dist[i] != encorebench::sssp_infinity) {
+      nb_visited++;
+      max_dist = std::max(max_dist, dist[i]);
+    }
+  }
+  std::cout << "nb_visited " << nb_visited << std::endl;
+  std::cout << "sssp_max_dist " << max_dist << std::endl;
+  if (deepsea::cmdline::parse_or_default_bool("check", false)) {
+    std::vector<int> expected(g.n);
+    encorebench::sssp_dijkstra(source, g, expected.data());
+    if (dist != expected) {
+      std::cout << "sssp_check failed" << std::endl;
+      exit(1);
+    }
+    std::cout << "sssp_check ok" << std::endl;
+  }
+}
+
+} // end namespace
+
+int main(int argc, char** argv) {
+  encorebench::initialize(argc, argv);
+  std::string infile = deepsea::cmdline::parse_or_default_string("infile", "");
+  if (infile == "") {
+    std::cout << "bogus input file name" << std::endl;
+    exit(0);
+  }
+  pbbs::benchmark(infile);
+  return 0;
+}
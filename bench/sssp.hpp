@@ -0,0 +1,142 @@
+#include <atomic>
+#include <vector>
+#include <limits>
+#include <utility>
+
+#include "graph.h"
+#include "multiqueue.hpp"
+
+#ifndef _ENCORE_SSSP_H_
+#define _ENCORE_SSSP_H_
+
+namespace encorebench {
+
+// **************************************************************
+//    SINGLE SOURCE SHORTEST PATHS
+//    The input graphs are unweighted: the weight of the edge from u
+//    to v is drawn, by a hash of u and v, in [1, max_weight].
+// **************************************************************
+
+static constexpr
+int sssp_infinity = std::numeric_limits<int>::max();
+
+int sssp_max_weight = 100;
+
+static inline
+int sssp_weight(int u, int v) {
+  unsigned int a = (unsigned int)u * 0x9E3779B1u ^ (unsigned int)v;
+  a = (a ^ 61) ^ (a >> 16);
+  a = a + (a << 3);
+  a = a ^ (a >> 4);
+  a = a * 0x27d4eb2d;
+  a = a ^ (a >> 15);
+  return 1 + (int)(a % (unsigned int)sssp_max_weight);
+}
+
+// Dijkstra, with one bucket per distance; as weights are at most
+// max_weight, max_weight + 1 buckets, used circularly, suffice
+void sssp_dijkstra(int source, pbbs::graph::graph<int>& g, int* dist) {
+  int n = g.n;
+  for (int i = 0; i < n; i++) {
+    dist[i] = sssp_infinity;
+  }
+  int nb_buckets = sssp_max_weight + 1;
+  std::vector<std::vector<int>> buckets(nb_buckets);
+  dist[source] = 0;
+  buckets[0].push_back(source);
+  long nb_pending = 1;
+  for (int d = 0; nb_pending > 0; d++) {
+    auto& b = buckets[d % nb_buckets];
+    while (! b.empty()) {
+      int u = b.back();
+      b.pop_back();
+      nb_pending--;
+      if (dist[u] != d) {
+        continue;
+      }
+      auto& vu = g.V[u];
+      for (int j = 0; j < vu.degree; j++) {
+        int v = vu.Neighbors[j];
+        int nd = d + sssp_weight(u, v);
+        if (nd < dist[v]) {
+          dist[v] = nd;
+          buckets[nd % nb_buckets].push_back(v);
+          nb_pending++;
+        }
+      }
+    }
+  }
+}
+
+// Delta stepping, in which the buckets of width delta are approximated
+// by the priorities of a relaxed priority worklist: an item is a vertex
+// along with the distance at which it was pushed, of priority the index
+// of the bucket of this distance
+class sssp : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  using item_type = std::pair<int, int>;
+
+  using worklist_type = encore::multiqueue<item_type, int>;
+
+  int source; pbbs::graph::graph<int> g; int delta; std::atomic<int>* dist;
+  worklist_type* worklist; encore::future<void> done;
+
+  sssp(int source, pbbs::graph::graph<int> g, int delta, std::atomic<int>* dist)
+  : source(source), g(g), delta(delta), dist(dist) { }
+
+  encore_dc_declare(encore::edsl, sssp, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto dist = s.dist;
+        return encore::parallel_for(st, pt, 0, s.g.n, [=] (int i) {
+          dist[i].store(sssp_infinity, std::memory_order_relaxed);
+        });
+      }),
+      dc::stmt([] (sar& s, par&) {
+        auto worklist = new worklist_type;
+        auto dist = s.dist;
+        auto V = s.g.V;
+        int delta = s.delta;
+        s.worklist = worklist;
+        dist[s.source].store(0);
+        worklist->push(std::make_pair(s.source, 0), 0);
+        s.done = encore::parallel_process(*worklist, [=] (item_type& x, int) {
+          int u = x.first;
+          int d = x.second;
+          if (dist[u].load(std::memory_order_relaxed) < d) {
+            return; // stale
+          }
+          auto& vu = V[u];
+          for (int j = 0; j < vu.degree; j++) {
+            int v = vu.Neighbors[j];
+            int nd = d + sssp_weight(u, v);
+            int orig = dist[v].load(std::memory_order_relaxed);
+            while (nd < orig) {
+              if (dist[v].compare_exchange_weak(orig, nd)) {
+                worklist->push(std::make_pair(v, nd), nd / delta);
+                break;
+              }
+            }
+          }
+        });
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.done.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        delete s.worklist;
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(sssp, get_cfg)
+
+} // end namespace
+
+#endif
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "encorebench.hpp"
+
+namespace cmdline = deepsea::cmdline;
+
+// items are sorted and merged by key only, so that the index of an
+// item in the input tells whether the order of equal keys is kept
+class item_type {
+public:
+  int key; int index;
+};
+
+bool operator==(item_type x, item_type y) {
+  return (x.key == y.key) && (x.index == y.index);
+}
+
+class compare_keys {
+public:
+  bool operator()(item_type x, item_type y) const {
+    return x.key < y.key;
+  }
+};
+
+int nb_distinct_keys(int n) {
+  return std::max(1, n / 8);
+}
+
+std::vector<item_type> random_items(int n, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dist(0, nb_distinct_keys(n) - 1);
+  std::vector<item_type> items(n);
+  for (int i = 0; i < n; i++) {
+    items[i].key = dist(gen);
+    items[i].index = i;
+  }
+  return items;
+}
+
+std::vector<int> random_ints(int n, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dist(0, nb_distinct_keys(n) - 1);
+  std::vector<int> xs(n);
+  for (int i = 0; i < n; i++) {
+    xs[i] = dist(gen);
+  }
+  return xs;
+}
+
+bool is_kept(int x) {
+  return (x % 3) == 0;
+}
+
+template <class Item>
+void check_same(const std::vector<Item>& test, const std::vector<Item>& ref) {
+  assert(test.size() == ref.size());
+  for (size_t i = 0; i < ref.size(); i++) {
+    assert(test[i] == ref[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  encorebench::initialize(argc, argv);
+  int n = cmdline::parse<int>("n");
+  cmdline::dispatcher d;
+  d.add("sort", [&] {
+    auto items = random_items(n, 1);
+    auto ref = items;
+    encorebench::run_and_report_elapsed_time([&] {
+      encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+        return encore::sort(st, items.begin(), items.end(), compare_keys());
+      });
+    });
+    std::stable_sort(ref.begin(), ref.end(), compare_keys());
+    check_same(items, ref);
+  });
+  d.add("merge", [&] {
+    auto items1 = random_items(n, 1);
+    auto items2 = random_items(n / 2, 2);
+    std::stable_sort(items1.begin(), items1.end(), compare_keys());
+    std::stable_sort(items2.begin(), items2.end(), compare_keys());
+    std::vector<item_type> test(items1.size() + items2.size());
+    encorebench::run_and_report_elapsed_time([&] {
+      encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+        return encore::merge(st, items1.begin(), items1.end(), items2.begin(), items2.end(),
+                             test.begin(), compare_keys());
+      });
+    });
+    std::vector<item_type> ref(test.size());
+    std::merge(items1.begin(), items1.end(), items2.begin(), items2.end(),
+               ref.begin(), compare_keys());
+    check_same(test, ref);
+  });
+  d.add("pack", [&] {
+    auto xs = random_ints(n, 1);
+    std::vector<bool> flags(n);
+    for (int i = 0; i < n; i++) {
+      flags[i] = is_kept(i);
+    }
+    std::vector<int> test(n);
+    int nb_kept = -1;
+    encorebench::run_and_report_elapsed_time([&] {
+      encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+        return encore::pack(st, xs.begin(), xs.end(), flags.begin(), test.begin(), &nb_kept);
+      });
+    });
+    test.resize(nb_kept);
+    std::vector<int> ref;
+    for (int i = 0; i < n; i++) {
+      if (flags[i]) {
+        ref.push_back(xs[i]);
+      }
+    }
+    check_same(test, ref);
+  });
+  d.add("filter", [&] {
+    auto xs = random_ints(n, 1);
+    std::vector<int> test(n);
+    int nb_kept = -1;
+    encorebench::run_and_report_elapsed_time([&] {
+      encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+        return encore::filter(st, xs.begin(), xs.end(), test.begin(), is_kept, &nb_kept);
+      });
+    });
+    test.resize(nb_kept);
+    std::vector<int> ref;
+    std::copy_if(xs.begin(), xs.end(), std::back_inserter(ref), is_kept);
+    check_same(test, ref);
+  });
+  d.add("dedupe", [&] {
+    auto xs = random_ints(n, 1);
+    std::vector<int> test(n);
+    int nb_unique = -1;
+    encorebench::run_and_report_elapsed_time([&] {
+      encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+        return encore::dedupe(st, xs.begin(), xs.end(), test.begin(), &nb_unique);
+      });
+    });
+    test.resize(nb_unique);
+    auto ref = xs;
+    std::sort(ref.begin(), ref.end());
+    ref.erase(std::unique(ref.begin(), ref.end()), ref.end());
+    check_same(test, ref);
+  });
+  d.dispatch("function");
+  return 0;
+}
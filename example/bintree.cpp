@@ -79,6 +79,19 @@ public:
 
 encore_pcfg_allocate(bintree, get_cfg)
 
+#ifdef ENCORE_HAVE_COROUTINES
+encore::coroutine::task bintree_coroutine(int lo, int hi, int* a) {
+  if (hi - lo <= cutoff) {
+    for (int i = lo; i < hi; i++) {
+      a[i]++;
+    }
+    co_return;
+  }
+  int mid = (lo + hi) / 2;
+  co_await encore::coroutine::fork2(bintree_coroutine(lo, mid, a), bintree_coroutine(mid, hi, a));
+}
+#endif
+
 int main(int argc, char** argv) {
   encorebench::initialize(argc, argv);
   int n = cmdline::parse<int>("n");
@@ -87,7 +100,16 @@ int main(int argc, char** argv) {
   for (int i = 0; i < n; i++) {
     a[i] = 0xdeadbeef;
   }
-  encore::launch_interpreter<bintree>(n, a);
+  cmdline::dispatcher d;
+  d.add("dc", [&] {
+    encore::launch_interpreter<bintree>(n, a);
+  });
+#ifdef ENCORE_HAVE_COROUTINES
+  d.add("coroutine", [&] {
+    encore::launch_coroutine(bintree_coroutine(0, n, a));
+  });
+#endif
+  d.dispatch_or_default("algorithm", "dc");
 #ifndef NDEBUG
   for (int i = 0; i < n; i++) {
     assert(a[i] == 0xdeadbeef + 1);
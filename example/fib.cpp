@@ -160,6 +160,18 @@ public:
 
 encore_pcfg_allocate(fib_dc, get_cfg)
 
+#ifdef ENCORE_HAVE_COROUTINES
+encore::coroutine::task fib_coroutine(int n, int* dp) {
+  if (n <= cutoff) {
+    *dp = fib(n);
+    co_return;
+  }
+  int d1, d2;
+  co_await encore::coroutine::fork2(fib_coroutine(n - 1, &d1), fib_coroutine(n - 2, &d2));
+  *dp = d1 + d2;
+}
+#endif
+
 namespace cmdline = deepsea::cmdline;
 
 int main(int argc, char** argv) {
@@ -185,6 +197,11 @@ int main(int argc, char** argv) {
   d.add("dc", [&] {
     encore::launch_interpreter<fib_dc>(n, &result);
   });
+#ifdef ENCORE_HAVE_COROUTINES
+  d.add("coroutine", [&] {
+    encore::launch_coroutine(fib_coroutine(n, &result));
+  });
+#endif
   encorebench::run_and_report_elapsed_time([&] {
     d.dispatch("algorithm");
   });
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+
+#include "encorebench.hpp"
+
+namespace sched = encore::sched;
+namespace cmdline = deepsea::cmdline;
+namespace dsl = encore::edsl;
+
+int nb_buckets = 64;
+
+using histogram_type = std::vector<int>;
+
+template <class T>
+T* malloc_array(size_t n) {
+  return (T*)malloc(n * sizeof(T));
+}
+
+static inline
+int bucket_of(int x) {
+  return x % nb_buckets;
+}
+
+using histogram_accumulator_type = encore::data::per_worker_accumulator<histogram_type>;
+
+class histogram_accumulator : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n; int* a; histogram_type* dst;
+  histogram_accumulator_type* r;
+
+  histogram_accumulator() { }
+
+  histogram_accumulator(int n, int* a, histogram_type* dst, histogram_accumulator_type* r)
+  : n(n), a(a), dst(dst), r(r) { }
+
+  encore_private_activation_record_begin(encore::edsl, histogram_accumulator, 1)
+    int lo; int hi;
+  encore_private_activation_record_end(encore::edsl, histogram_accumulator, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::parallel_for_loop([] (sar& s, par& p) {
+        p.lo = 0;
+        p.hi = s.n;
+      }, [] (par& p) {
+        return std::make_pair(&p.lo, &p.hi);
+      }, [] (sar& s, par& p, int lo, int hi) {
+        histogram_type& h = s.r->mine();
+        auto a = s.a;
+        for (auto i = lo; i != hi; i++) {
+          h[bucket_of(a[i])]++;
+        }
+      }, __LINE__, __FILE__),
+      dc::stmt([] (sar& s, par&) {
+        *s.dst = s.r->reduce();
+        s.r->reset();
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(histogram_accumulator, get_cfg)
+
+class histogram_atomic : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n; int* a; histogram_type* dst;
+  std::atomic<int>* cells;
+
+  histogram_atomic() { }
+
+  histogram_atomic(int n, int* a, histogram_type* dst)
+  : n(n), a(a), dst(dst) { }
+
+  encore_private_activation_record_begin(encore::edsl, histogram_atomic, 1)
+    int lo; int hi;
+  encore_private_activation_record_end(encore::edsl, histogram_atomic, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.cells = new std::atomic<int>[nb_buckets];
+        for (int i = 0; i < nb_buckets; i++) {
+          s.cells[i].store(0);
+        }
+      }),
+      dc::parallel_for_loop([] (sar& s, par& p) {
+        p.lo = 0;
+        p.hi = s.n;
+      }, [] (par& p) {
+        return std::make_pair(&p.lo, &p.hi);
+      }, [] (sar& s, par& p, int lo, int hi) {
+        auto a = s.a;
+        for (auto i = lo; i != hi; i++) {
+          s.cells[bucket_of(a[i])]++;
+        }
+      }, __LINE__, __FILE__),
+      dc::stmt([] (sar& s, par&) {
+        s.dst->resize(nb_buckets);
+        for (int i = 0; i < nb_buckets; i++) {
+          (*s.dst)[i] = s.cells[i].load();
+        }
+        delete [] s.cells;
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(histogram_atomic, get_cfg)
+
+int main(int argc, char** argv) {
+  encorebench::initialize(argc, argv);
+  int n = cmdline::parse<int>("n");
+  nb_buckets = cmdline::parse_or_default("nb_buckets", nb_buckets);
+  int* a = malloc_array<int>(n);
+  for (int i = 0; i < n; i++) {
+    a[i] = i;
+  }
+  histogram_type result;
+  // held here, rather than allocated by new, which ignores the cache-line
+  // alignment of its views before C++17
+  histogram_accumulator_type r(histogram_type(nb_buckets, 0), [] (histogram_type& dst, histogram_type& src) {
+    for (int i = 0; i < nb_buckets; i++) {
+      dst[i] += src[i];
+    }
+  });
+  encorebench::run_and_report_elapsed_time([&] {
+    cmdline::dispatcher d;
+    d.add("accumulator", [&] {
+      encore::launch_interpreter<histogram_accumulator>(n, a, &result, &r);
+    });
+    d.add("atomic", [&] {
+      encore::launch_interpreter<histogram_atomic>(n, a, &result);
+    });
+    d.dispatch_or_default("algorithm", "accumulator");
+  });
+#ifndef NDEBUG
+  histogram_type expected(nb_buckets, 0);
+  for (int i = 0; i < n; i++) {
+    expected[bucket_of(a[i])]++;
+  }
+  assert(result == expected);
+#endif
+  free(a);
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "encorebench.hpp"
+
+namespace cmdline = deepsea::cmdline;
+
+int block_szb = 1 << 20;
+
+static inline
+int value_at(int i) {
+  return (i * 7) % 1001;
+}
+
+// writes the items of src to the file fd, one io::write per block, and
+// then loads them back into dst, one io::read per block, before
+// decoding them in parallel
+class loader : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n; int fd; int* src; int* dst;
+  char* buf;
+  std::vector<encore::future<ssize_t>> rs;
+  encore::future<std::vector<ssize_t>> r;
+
+  loader() { }
+
+  loader(int n, int fd, int* src, int* dst)
+  : n(n), fd(fd), src(src), dst(dst) { }
+
+  encore_private_activation_record_begin(encore::edsl, loader, 1)
+    int lo; int hi;
+  encore_private_activation_record_end(encore::edsl, loader, sar, par, dc, get_dc)
+
+  static
+  void check_transfers(sar& s) {
+    size_t nbytes = s.n * sizeof(int);
+    auto ns = s.r.get();
+    for (size_t i = 0; i < ns.size(); i++) {
+      size_t szb = std::min((size_t)block_szb, nbytes - i * block_szb);
+      if (ns[i] != (ssize_t)szb) {
+        encore::atomic::die("loader: block %d transferred %ld of %ld bytes\n",
+                            (int)i, (long)ns[i], (long)szb);
+      }
+    }
+    s.rs.clear();
+  }
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        size_t nbytes = s.n * sizeof(int);
+        auto src = (char*)s.src;
+        for (size_t i = 0; i < nbytes; i += block_szb) {
+          size_t szb = std::min((size_t)block_szb, nbytes - i);
+          s.rs.push_back(encore::io::write(s.fd, src + i, szb, (off_t)i));
+        }
+        s.r = encore::when_all(s.rs);
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        check_transfers(s);
+        size_t nbytes = s.n * sizeof(int);
+        s.buf = (char*)malloc(nbytes);
+        for (size_t i = 0; i < nbytes; i += block_szb) {
+          size_t szb = std::min((size_t)block_szb, nbytes - i);
+          s.rs.push_back(encore::io::read(s.fd, s.buf + i, szb, (off_t)i));
+        }
+        s.r = encore::when_all(s.rs);
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        check_transfers(s);
+      }),
+      dc::parallel_for_loop([] (sar& s, par& p) {
+        p.lo = 0;
+        p.hi = s.n;
+      }, [] (par& p) {
+        return std::make_pair(&p.lo, &p.hi);
+      }, [] (sar& s, par& p, int lo, int hi) {
+        auto buf = (int*)s.buf;
+        auto dst = s.dst;
+        for (auto i = lo; i != hi; i++) {
+          dst[i] = buf[i];
+        }
+      }, __LINE__, __FILE__),
+      dc::stmt([] (sar& s, par&) {
+        free(s.buf);
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(loader, get_cfg)
+
+int main(int argc, char** argv) {
+  encorebench::initialize(argc, argv);
+  int n = cmdline::parse<int>("n");
+  block_szb = cmdline::parse_or_default("block_szb", block_szb);
+  std::string path = cmdline::parse_or_default_string("path", "/tmp/encore_loader.dat");
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0) {
+    encore::atomic::die("loader: cannot open %s\n", path.c_str());
+  }
+  std::vector<int> src(n);
+  std::vector<int> dst(n, -1);
+  for (int i = 0; i < n; i++) {
+    src[i] = value_at(i);
+  }
+  encorebench::run_and_report_elapsed_time([&] {
+    encore::launch_interpreter<loader>(n, fd, src.data(), dst.data());
+  });
+  close(fd);
+  unlink(path.c_str());
+#ifndef NDEBUG
+  assert(dst == src);
+#endif
+  return 0;
+}
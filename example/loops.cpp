@@ -9,6 +9,8 @@ namespace dsl = encore::edsl;
 
 int cutoff = 1;
 
+int nb_rounds = 100;
+
 class sequential_loop_0 : public encore::edsl::pcfg::shared_activation_record {
 public:
     
@@ -445,10 +447,402 @@ public:
 
 encore_pcfg_allocate(parallel_combine_1, get_cfg)
 
+void lambda_loop(int n) {
+  int* a = new int[n];
+  encore::launch_interpreter_via_lambda([=] (encore::stack_type st) {
+    return encore::parallel_for(st, 0, n, [=] (int i) {
+      a[i] = 0xdeadbeef;
+    });
+  });
+  for (int i = 0; i < n; i++) {
+    assert(a[i] == 0xdeadbeef);
+  }
+  delete [] a;
+}
+
+void lambda_nested_loop(int n) {
+  int* a = new int[n * n];
+  encore::launch_interpreter_via_lambda([=] (encore::stack_type st) {
+    return encore::parallel_for(st, 0, n, [=] (encore::stack_type st, encore::parent_link_type p, int i) {
+      return encore::parallel_for(st, p, 0, n, [=] (int j) {
+        a[i * n + j] = 0xdeadbeef;
+      });
+    });
+  });
+  for (int i = 0; i < n * n; i++) {
+    assert(a[i] == 0xdeadbeef);
+  }
+  delete [] a;
+}
+
+void lambda_combine(int n) {
+  int* a = new int[n];
+  for (int i = 0; i < n; i++) {
+    a[i] = i % 1024;
+  }
+  int result = 0;
+  int* dest = &result;
+  encore::launch_interpreter_via_lambda([=] (encore::stack_type st) {
+    return encore::parallel_reduce(st, 0, n, 0, [] (int x, int y) {
+      return x + y;
+    }, [=] (int i) {
+      return a[i];
+    }, dest);
+  });
+#ifndef NDEBUG
+  int acc2 = 0;
+  for (int i = 0; i < n; i++) {
+    acc2 += a[i];
+  }
+  assert(result == acc2);
+#endif
+  delete [] a;
+}
+
+// nb_rounds rounds of a parallel loop, each of which is joined before
+// the next one starts
+class rounds_loop_0 : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  int* a; int round;
+
+  rounds_loop_0() { }
+
+  rounds_loop_0(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, rounds_loop_0, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.a = new int[s.n]();
+        s.round = 0;
+      }),
+      dc::sequential_loop([] (sar& s, par&) { return s.round != nb_rounds; }, dc::stmts({
+        dc::spawn_join([] (sar& s, par&, plt p, stt st) {
+          int* a = s.a;
+          return encore::parallel_for(st, p, 0, s.n, [=] (int i) {
+            a[i]++;
+          });
+        }),
+        dc::stmt([] (sar& s, par&) {
+          s.round++;
+        })
+      })),
+      dc::stmt([] (sar& s, par&) {
+        for (int i = 0; i < s.n; i++) {
+          assert(s.a[i] == nb_rounds);
+        }
+        delete [] s.a;
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(rounds_loop_0, get_cfg)
+
+// the same rounds, by encore::parallel_rounds
+class rounds_loop_1 : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  int* a;
+  encore::future<int> r;
+
+  rounds_loop_1() { }
+
+  rounds_loop_1(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, rounds_loop_1, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        int* a = new int[s.n]();
+        s.a = a;
+        s.r = encore::parallel_rounds(s.n, [=] (int, int lo, int hi) {
+          for (int i = lo; i < hi; i++) {
+            a[i]++;
+          }
+        }, [] (int round) {
+          return round + 1 < nb_rounds;
+        });
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        assert(s.r.get() == nb_rounds);
+        for (int i = 0; i < s.n; i++) {
+          assert(s.a[i] == nb_rounds);
+        }
+        delete [] s.a;
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(rounds_loop_1, get_cfg)
+
+// a bag holds a per-worker array, whose cells are aligned beyond what
+// operator new guarantees before C++17, so bags go in aligned storage
+template <class Bag>
+Bag* new_bag() {
+  void* p = nullptr;
+  if (posix_memalign(&p, alignof(Bag), sizeof(Bag)) != 0) {
+    encore::atomic::die("loops: cannot allocate a bag\n");
+  }
+  return new (p) Bag;
+}
+
+template <class Bag>
+void delete_bag(Bag* b) {
+  b->~Bag();
+  free(b);
+}
+
+// rounds of a worklist in a bag: each round consumes the items of the
+// current bag, and inserts the work of the next round into another bag
+class bag_loop : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  encore::bag<int>* current; encore::bag<int>* next;
+  encore::future<void> done;
+  long nb_visited;
+
+  bag_loop() { }
+
+  bag_loop(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, bag_loop, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.current = new_bag<encore::bag<int>>();
+        s.next = new_bag<encore::bag<int>>();
+        for (int i = 0; i < s.n; i++) {
+          s.current->insert(i);
+        }
+        s.nb_visited = 0;
+      }),
+      dc::sequential_loop([] (sar& s, par&) { return ! s.current->empty(); }, dc::stmts({
+        dc::stmt([] (sar& s, par&) {
+          s.nb_visited += s.current->size();
+          auto next = s.next;
+          s.done = encore::parallel_for_each(*s.current, [=] (int& x) {
+            if (x % 2 == 1) {
+              next->insert(x / 2);
+            }
+          });
+        }),
+        dc::join_minus([] (sar& s, par&) {
+          return s.done.get_future();
+        }),
+        dc::stmt([] (sar& s, par&) {
+          s.current->merge(*s.next);
+        })
+      })),
+      dc::stmt([] (sar& s, par&) {
+        printf("nb_visited %ld\n", s.nb_visited);
+        delete_bag(s.current);
+        delete_bag(s.next);
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(bag_loop, get_cfg)
+
+long sum_below(int n) {
+  long r = 0;
+  for (int i = 0; i < n; i++) {
+    r += i;
+  }
+  return r;
+}
+
+// a chain of then() on the futures of async()
+class future_then : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  encore::future<long> r;
+  encore::future<int> v;
+
+  future_then() { }
+
+  future_then(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, future_then, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        int n = s.n;
+        s.r = encore::async([=] {
+          return sum_below(n);
+        }).then([] (long& x) {
+          return 2 * x;
+        }).then([] (long& x) {
+          return x + 1;
+        });
+        s.v = encore::async([] { }).then([] {
+          return 1;
+        });
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r.get_future();
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.v.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        assert(s.r.get() == 2 * sum_below(s.n) + 1);
+        assert(s.v.get() == 1);
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(future_then, get_cfg)
+
+// both overloads of when_all(): on a list of futures, of which one is
+// ready from the start, and on a vector of futures
+class future_when_all : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  encore::future<std::tuple<long, int, long>> t;
+  encore::future<long> total;
+
+  future_when_all() { }
+
+  future_when_all(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, future_when_all, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        int n = s.n;
+        auto a = encore::async([=] {
+          return sum_below(n);
+        });
+        auto b = encore::make_ready_future(n);
+        auto c = a.then([] (long& x) {
+          return x + 1;
+        });
+        s.t = encore::when_all(a, b, c);
+        std::vector<encore::future<long>> fs;
+        for (int i = 0; i < std::min(n, 1000); i++) {
+          fs.push_back(encore::async([=] {
+            return sum_below(i);
+          }));
+        }
+        s.total = encore::when_all(fs).then([] (std::vector<long>& xs) {
+          long r = 0;
+          for (auto x : xs) {
+            r += x;
+          }
+          return r;
+        });
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.t.get_future();
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.total.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        auto& t = s.t.get();
+        assert(std::get<0>(t) == sum_below(s.n));
+        assert(std::get<1>(t) == s.n);
+        assert(std::get<2>(t) == sum_below(s.n) + 1);
+        long total = 0;
+        for (int i = 0; i < std::min(s.n, 1000); i++) {
+          total += sum_below(i);
+        }
+        assert(s.total.get() == total);
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(future_when_all, get_cfg)
+
+// futures made by make_ready_future(), which have no vertex: join_minus
+// goes right through them
+class future_ready : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  int n;
+  encore::future<int> r;
+  encore::future<int> r2;
+  encore::future<std::tuple<int, int>> t;
+
+  future_ready() { }
+
+  future_ready(int n)
+  : n(n) { }
+
+  encore_dc_declare(encore::edsl, future_ready, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.r = encore::make_ready_future(s.n);
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        assert(s.r.get() == s.n);
+        s.r2 = s.r.then([] (int& x) {
+          return x + 1;
+        });
+        s.t = encore::when_all(encore::make_ready_future(1), encore::make_ready_future(2));
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.r2.get_future();
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.t.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        assert(s.r2.get() == s.n + 1);
+        assert(s.t.get() == std::make_tuple(1, 2));
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(future_ready, get_cfg)
+
 int main(int argc, char** argv) {
   encorebench::initialize(argc, argv);
   int n = cmdline::parse<int>("n");
   cutoff = cmdline::parse_or_default("cutoff", cutoff);
+  nb_rounds = std::max(1, cmdline::parse_or_default("rounds", nb_rounds));
   encorebench::run_and_report_elapsed_time([&] {
     cmdline::dispatcher d;
     d.add("sequential_loop_0", [=] {
@@ -475,6 +869,33 @@ int main(int argc, char** argv) {
     d.add("parallel_combine_1", [=] {
       encore::launch_interpreter<parallel_combine_1>(n);
     });
+    d.add("lambda_loop", [=] {
+      lambda_loop(n);
+    });
+    d.add("lambda_nested_loop", [=] {
+      lambda_nested_loop(n);
+    });
+    d.add("lambda_combine", [=] {
+      lambda_combine(n);
+    });
+    d.add("sequential_rounds", [=] {
+      encore::launch_interpreter<rounds_loop_0>(n);
+    });
+    d.add("parallel_rounds", [=] {
+      encore::launch_interpreter<rounds_loop_1>(n);
+    });
+    d.add("bag_loop", [=] {
+      encore::launch_interpreter<bag_loop>(n);
+    });
+    d.add("future_then", [=] {
+      encore::launch_interpreter<future_then>(n);
+    });
+    d.add("future_when_all", [=] {
+      encore::launch_interpreter<future_when_all>(n);
+    });
+    d.add("future_ready", [=] {
+      encore::launch_interpreter<future_ready>(n);
+    });
     d.dispatch_or_default("function", "sequential_loop_0");
   });
   return 0;
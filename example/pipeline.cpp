@@ -0,0 +1,102 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+
+#include "encorebench.hpp"
+
+namespace cmdline = deepsea::cmdline;
+namespace pipeline = encore::pipeline;
+
+using item_type = uint64_t;
+
+// a synthetic, compute-bound transformation
+item_type transform(item_type x) {
+  for (int i = 0; i < 64; i++) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+  }
+  return x;
+}
+
+item_type expected_result(long n) {
+  item_type r = 0;
+  for (long i = 0; i < n; i++) {
+    r += transform(i);
+  }
+  return r;
+}
+
+class stream : public encore::edsl::pcfg::shared_activation_record {
+public:
+
+  long n; int batch_size; int capacity; item_type* result;
+  long next = 0;
+  pipeline::channel<item_type>* input;
+  pipeline::channel<item_type>* output;
+  encore::future<void> done;
+
+  stream() { }
+
+  stream(long n, int batch_size, int capacity, item_type* result)
+  : n(n), batch_size(batch_size), capacity(capacity), result(result) { }
+
+  encore_dc_declare(encore::edsl, stream, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.input = new pipeline::channel<item_type>(s.capacity);
+        s.output = new pipeline::channel<item_type>(s.capacity);
+        *s.result = 0;
+        sar* sp = &s;
+        pipeline::source(*s.input, [=] (std::vector<item_type>& batch) {
+          long lo = sp->next;
+          long hi = std::min(sp->n, lo + sp->batch_size);
+          for (long i = lo; i < hi; i++) {
+            batch.push_back(i);
+          }
+          sp->next = hi;
+          return lo != hi;
+        });
+        pipeline::parallel_map(*s.input, *s.output, [] (item_type x) {
+          return transform(x);
+        });
+        s.done = pipeline::sink(*s.output, [=] (std::vector<item_type>& batch) {
+          for (auto x : batch) {
+            *sp->result += x;
+          }
+        });
+      }),
+      dc::join_minus([] (sar& s, par&) {
+        return s.done.get_future();
+      }),
+      dc::stmt([] (sar& s, par&) {
+        // at most capacity batches per channel, plus one batch per stage
+        long bound = (2 * s.capacity + 3) * (long)s.batch_size;
+        long peak = (s.input->get_peak_nb_batches() + s.output->get_peak_nb_batches()) * (long)s.batch_size;
+        printf("pipeline_items_bound %ld\n", bound);
+        printf("pipeline_peak_buffered_items %ld\n", peak);
+        delete s.input;
+        delete s.output;
+      })
+    });
+  }
+
+};
+
+encore_pcfg_allocate(stream, get_cfg)
+
+int main(int argc, char** argv) {
+  encorebench::initialize(argc, argv);
+  long n = cmdline::parse_or_default_int("n", 1 << 20);
+  int batch_size = cmdline::parse_or_default_int("batch_size", 4096);
+  int capacity = cmdline::parse_or_default_int("capacity", 4);
+  item_type result = 0;
+  auto start = std::chrono::system_clock::now();
+  encore::launch_interpreter<stream>(n, batch_size, capacity, &result);
+  std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+  printf("items_per_second %.0lf\n", n / elapsed.count());
+  assert(result == expected_result(n));
+  return 0;
+}
@@ -164,11 +164,10 @@ int main(int argc, char** argv) {
   encorebench::initialize(argc, argv);
   int n = cmdline::parse<int>("n");
   branching_factor = cmdline::parse_or_default("branching_factor", branching_factor);
-  value_type* src = malloc_array<value_type>(n);
-  value_type* dst = malloc_array<value_type>(n);
-  for (int i = 0; i < n; i++) {
-    src[i] = 1;
-  }
+  encore::numa_array<value_type> src_array(n, 1);
+  encore::numa_array<value_type> dst_array(n);
+  value_type* src = src_array.data();
+  value_type* dst = dst_array.data();
   cmdline::dispatcher d;
   d.add("serial", [&] {
     scan_serial(0, n, 0, src, dst);
@@ -179,6 +178,11 @@ int main(int argc, char** argv) {
   d.add("encore", [&] {
     encore::launch_interpreter<scan_dc>(n, 0, src, dst);
   });
+  d.add("library", [&] {
+    encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+      return encore::scan(st, src, src + n, dst, 0, std::plus<value_type>());
+    });
+  });
   encorebench::run_and_report_elapsed_time([&] {
     d.dispatch_or_default("algorithm", "serial");
   });
@@ -195,7 +199,5 @@ int main(int argc, char** argv) {
   free(src2);
   free(dst2);
 #endif
-  free(src);
-  free(dst);
   return 0;
 }
@@ -0,0 +1,105 @@
+
+#include <functional>
+
+#include "perworker.hpp"
+
+#ifndef _ENCORE_ACCUMULATOR_H_
+#define _ENCORE_ACCUMULATOR_H_
+
+namespace encore {
+namespace data {
+
+/*---------------------------------------------------------------------*/
+/* Per-worker accumulator
+ *
+ * A per-worker accumulator holds one private view of a value for each
+ * worker. Any strand, no matter how deeply nested in spawns or parallel
+ * loops, may update the view of the worker that runs it, by calling
+ * mine(). Views are created lazily, by copying the identity, the first
+ * time a worker touches the accumulator.
+ *
+ * The views are merged by reduce(), which is to be called by the
+ * continuation of the join that ends the parallel region (e.g., in the
+ * dc::stmt that follows a parallel_for_loop, a spawn2_join or a
+ * join_plus). At that point, every strand that could update a view has
+ * completed, and the join (an incounter decrement) orders their writes
+ * before the merge.
+ *
+ * This is not a reducer hyperobject: views belong to workers, not to
+ * promoted strands, and nothing merges them at the joins that
+ * promotions create. Hence:
+ *  - the order in which updates are merged is unspecified, so that the
+ *    combining operator must be associative and commutative;
+ *  - an accumulator serves one parallel region at a time: it cannot be
+ *    shared by nested or concurrent regions, as their updates would mix
+ *    in the same views; reset() it before using it again.
+ */
+
+template <class Item>
+class per_worker_accumulator {
+public:
+
+  // combine(dst, src) merges the contents of src into dst
+  using combine_type = std::function<void(Item&, Item&)>;
+
+private:
+
+  class view_type {
+  public:
+    bool initialized = false;
+    Item value;
+  };
+
+  Item identity;
+
+  combine_type combine;
+
+  perworker::array<view_type> views;
+
+public:
+
+  per_worker_accumulator(const Item& identity, combine_type combine)
+  : identity(identity), combine(combine) { }
+
+  // returns the view of the calling worker
+  Item& mine() {
+    view_type& v = views.mine();
+    if (! v.initialized) {
+      v.value = identity;
+      v.initialized = true;
+    }
+    return v.value;
+  }
+
+  template <class Update>
+  void update(const Update& f) {
+    f(mine());
+  }
+
+  // merges all views into a fresh copy of the identity; views are left untouched
+  Item reduce() {
+    Item result = identity;
+    views.for_each([&] (int, view_type& v) {
+      if (v.initialized) {
+        combine(result, v.value);
+      }
+    });
+    return result;
+  }
+
+  // discards all views, so that the accumulator can be used again
+  void reset() {
+    views.for_each([&] (int, view_type& v) {
+      if (v.initialized) {
+        v.value = identity;
+        v.initialized = false;
+      }
+    });
+  }
+
+};
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_ACCUMULATOR_H_ */
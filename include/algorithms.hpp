@@ -0,0 +1,507 @@
+#include <iterator>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "edsl.hpp"
+#include "parallel.hpp"
+
+#ifndef _ENCORE_ALGORITHMS_H_
+#define _ENCORE_ALGORITHMS_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Parallel sequence algorithms
+ *
+ * Generic versions of the sequence algorithms of the benchmarks, over
+ * random-access iterators, and with no dependency on the benchmark
+ * headers: scan, pack, filter, merge, sort and dedupe. Each of them is
+ * a DSL call, in the style of parallel.hpp, that is, it pushes its
+ * activation records on the given stack, and its parallelism is latent,
+ * promoted at heartbeats. It may be called from the body of a
+ * dc::spawn_join, from the function given to
+ * launch_interpreter_via_lambda, or from a lambda that is given to
+ * fork2 or parallel_for:
+ *
+ *   encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+ *     return encore::sort(st, v.begin(), v.end());
+ *   });
+ *
+ * Each function takes, optionally, the parent link of the call, right
+ * after the stack. Sizes are ints, as in the loops of parallel.hpp.
+ * The items are to be default constructible and copy assignable, and
+ * the combining operator of scan is to be associative.
+ */
+
+namespace algorithms {
+
+// number of items of the blocks of scan and pack, and of the leaves of
+// merge and sort, under which they run sequentially
+int block_size = 2048;
+
+template <class Iterator>
+using value_type_of = typename std::iterator_traits<Iterator>::value_type;
+
+static inline
+int nb_blocks_of(int n, int bsz) {
+  return (n + bsz - 1) / bsz;
+}
+
+/*---------------------------------------------------------------------*/
+/* Scan */
+
+template <class Input, class Output, class Item, class Combine>
+void scan_serial(Input first, int lo, int hi, Output d_first, Item acc, Combine& combine, Item* total) {
+  for (int i = lo; i < hi; i++) {
+    Item x = first[i];
+    d_first[i] = acc;
+    acc = combine(acc, x);
+  }
+  if (total != nullptr) {
+    *total = acc;
+  }
+}
+
+template <class Input, class Output, class Item, class Combine>
+stack_type scan(stack_type st, parent_link_type p, Input first, int n, Output d_first,
+                Item init, Combine combine, Item* total);
+
+// reduces each block of the input, scans the sums of the blocks, by a
+// recursive call, and then scans each block from the sum of the blocks
+// on its left
+template <class Input, class Output, class Item, class Combine>
+class scan_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  Input first; int n; Output d_first;
+  Item init; Combine combine; Item* total;
+  int bsz; int nb_blocks; Item* sums;
+
+  scan_rec(Input first, int n, Output d_first, Item init, Combine combine, Item* total)
+  : first(first), n(n), d_first(d_first), init(init), combine(combine), total(total) { }
+
+  encore_dc_declare(encore::edsl, scan_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.bsz = block_size;
+        s.nb_blocks = nb_blocks_of(s.n, s.bsz);
+        s.sums = new Item[s.nb_blocks];
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto first = s.first; auto sums = s.sums; auto combine = s.combine;
+        int n = s.n; int bsz = s.bsz;
+        return encore::parallel_for(st, pt, 0, s.nb_blocks, [=] (int b) mutable {
+          int lo = b * bsz;
+          int hi = std::min(n, lo + bsz);
+          Item acc = first[lo];
+          for (int i = lo + 1; i < hi; i++) {
+            acc = combine(acc, first[i]);
+          }
+          sums[b] = acc;
+        });
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        return algorithms::scan(st, pt, s.sums, s.nb_blocks, s.sums, s.init, s.combine, s.total);
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto first = s.first; auto d_first = s.d_first; auto sums = s.sums; auto combine = s.combine;
+        int n = s.n; int bsz = s.bsz;
+        return encore::parallel_for(st, pt, 0, s.nb_blocks, [=] (int b) mutable {
+          int lo = b * bsz;
+          int hi = std::min(n, lo + bsz);
+          scan_serial(first, lo, hi, d_first, sums[b], combine, (Item*)nullptr);
+        });
+      }),
+      dc::stmt([] (sar& s, par&) {
+        delete [] s.sums;
+      })
+    });
+  }
+
+};
+
+template <class Input, class Output, class Item, class Combine>
+typename scan_rec<Input,Output,Item,Combine>::cfg_type scan_rec<Input,Output,Item,Combine>::cfg = scan_rec<Input,Output,Item,Combine>::get_cfg();
+
+template <class Input, class Output, class Item, class Combine>
+stack_type scan(stack_type st, parent_link_type p, Input first, int n, Output d_first,
+                Item init, Combine combine, Item* total) {
+  if (n <= block_size) {
+    auto f = [=] () mutable {
+      scan_serial(first, 0, n, d_first, init, combine, total);
+    };
+    return edsl::pcfg::push_call<lambda::call_rec<decltype(f)>>(st, p, f);
+  }
+  return edsl::pcfg::push_call<scan_rec<Input,Output,Item,Combine>>(st, p, first, n, d_first, init, combine, total);
+}
+
+/*---------------------------------------------------------------------*/
+/* Pack */
+
+// copies to d_first, in order, the items first[i] for which keep(i)
+// holds: each block counts the items that it keeps, and then writes them
+// from the sum of the counts of the blocks on its left
+template <class Input, class Output, class Keep>
+class pack_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  Input first; int n; Output d_first; Keep keep; int* nb_kept;
+  int bsz; int nb_blocks; int* counts;
+
+  pack_rec(Input first, int n, Output d_first, Keep keep, int* nb_kept)
+  : first(first), n(n), d_first(d_first), keep(keep), nb_kept(nb_kept) { }
+
+  encore_dc_declare(encore::edsl, pack_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.bsz = block_size;
+        s.nb_blocks = nb_blocks_of(s.n, s.bsz);
+        s.counts = new int[s.nb_blocks];
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto counts = s.counts; auto keep = s.keep;
+        int n = s.n; int bsz = s.bsz;
+        return encore::parallel_for(st, pt, 0, s.nb_blocks, [=] (int b) mutable {
+          int lo = b * bsz;
+          int hi = std::min(n, lo + bsz);
+          int c = 0;
+          for (int i = lo; i < hi; i++) {
+            if (keep(i)) {
+              c++;
+            }
+          }
+          counts[b] = c;
+        });
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        return algorithms::scan(st, pt, s.counts, s.nb_blocks, s.counts, 0, std::plus<int>(), s.nb_kept);
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto first = s.first; auto d_first = s.d_first; auto counts = s.counts; auto keep = s.keep;
+        int n = s.n; int bsz = s.bsz;
+        return encore::parallel_for(st, pt, 0, s.nb_blocks, [=] (int b) mutable {
+          int lo = b * bsz;
+          int hi = std::min(n, lo + bsz);
+          int j = counts[b];
+          for (int i = lo; i < hi; i++) {
+            if (keep(i)) {
+              d_first[j++] = first[i];
+            }
+          }
+        });
+      }),
+      dc::stmt([] (sar& s, par&) {
+        delete [] s.counts;
+      })
+    });
+  }
+
+};
+
+template <class Input, class Output, class Keep>
+typename pack_rec<Input,Output,Keep>::cfg_type pack_rec<Input,Output,Keep>::cfg = pack_rec<Input,Output,Keep>::get_cfg();
+
+template <class Input, class Output, class Keep>
+stack_type pack(stack_type st, parent_link_type p, Input first, int n, Output d_first,
+                Keep keep, int* nb_kept) {
+  return edsl::pcfg::push_call<pack_rec<Input,Output,Keep>>(st, p, first, n, d_first, keep, nb_kept);
+}
+
+/*---------------------------------------------------------------------*/
+/* Merge */
+
+// splits the larger of the two inputs at its middle item, and the other
+// one at the position of this item, so that the two halves of the output
+// are merged in parallel; items of the first input go before equal
+// items of the second, as in std::merge
+template <class Input1, class Input2, class Output, class Compare>
+stack_type merge(stack_type st, parent_link_type p, Input1 first1, Input1 last1,
+                 Input2 first2, Input2 last2, Output d_first, Compare comp) {
+  int n1 = (int)(last1 - first1);
+  int n2 = (int)(last2 - first2);
+  if (n1 + n2 <= std::max(2, block_size)) {
+    auto f = [=] {
+      std::merge(first1, last1, first2, last2, d_first, comp);
+    };
+    return edsl::pcfg::push_call<lambda::call_rec<decltype(f)>>(st, p, f);
+  }
+  Input1 mid1;
+  Input2 mid2;
+  if (n1 >= n2) {
+    mid1 = first1 + n1 / 2;
+    mid2 = std::lower_bound(first2, last2, *mid1, comp);
+  } else {
+    mid2 = first2 + n2 / 2;
+    mid1 = std::upper_bound(first1, last1, *mid2, comp);
+  }
+  Output d_mid = d_first + ((mid1 - first1) + (mid2 - first2));
+  return encore::fork2(st, p, [=] (stack_type st, parent_link_type p) {
+    return algorithms::merge(st, p, first1, mid1, first2, mid2, d_first, comp);
+  }, [=] (stack_type st, parent_link_type p) {
+    return algorithms::merge(st, p, mid1, last1, mid2, last2, d_mid, comp);
+  });
+}
+
+/*---------------------------------------------------------------------*/
+/* Sort */
+
+template <class Iterator, class Compare>
+stack_type sort(stack_type st, parent_link_type p, Iterator first, int n,
+                value_type_of<Iterator>* tmp, bool to_tmp, Compare comp);
+
+// merge sort of [first, first + n), which leaves the sorted items in
+// tmp if to_tmp is set, or else in place: the two halves are sorted, in
+// parallel, into the other of the two buffers, and then merged from
+// there, so that the buffers take turns from one level to the next
+template <class Iterator, class Compare>
+class sort_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  using item_type = value_type_of<Iterator>;
+
+  Iterator first; int n; item_type* tmp; bool to_tmp; Compare comp;
+
+  sort_rec(Iterator first, int n, item_type* tmp, bool to_tmp, Compare comp)
+  : first(first), n(n), tmp(tmp), to_tmp(to_tmp), comp(comp) { }
+
+  encore_dc_declare(encore::edsl, sort_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::spawn2_join([] (sar& s, par&, plt pt, stt st) {
+        return algorithms::sort(st, pt, s.first, s.n / 2, s.tmp, ! s.to_tmp, s.comp);
+      }, [] (sar& s, par&, plt pt, stt st) {
+        int h = s.n / 2;
+        return algorithms::sort(st, pt, s.first + h, s.n - h, s.tmp + h, ! s.to_tmp, s.comp);
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        int h = s.n / 2;
+        if (s.to_tmp) {
+          return algorithms::merge(st, pt, s.first, s.first + h, s.first + h, s.first + s.n, s.tmp, s.comp);
+        } else {
+          return algorithms::merge(st, pt, s.tmp, s.tmp + h, s.tmp + h, s.tmp + s.n, s.first, s.comp);
+        }
+      })
+    });
+  }
+
+};
+
+template <class Iterator, class Compare>
+typename sort_rec<Iterator,Compare>::cfg_type sort_rec<Iterator,Compare>::cfg = sort_rec<Iterator,Compare>::get_cfg();
+
+// tmp is a buffer of n items
+template <class Iterator, class Compare>
+stack_type sort(stack_type st, parent_link_type p, Iterator first, int n,
+                value_type_of<Iterator>* tmp, bool to_tmp, Compare comp) {
+  if (n <= std::max(2, block_size)) {
+    auto f = [=] {
+      std::stable_sort(first, first + n, comp);
+      if (to_tmp) {
+        std::copy(first, first + n, tmp);
+      }
+    };
+    return edsl::pcfg::push_call<lambda::call_rec<decltype(f)>>(st, p, f);
+  }
+  return edsl::pcfg::push_call<sort_rec<Iterator,Compare>>(st, p, first, n, tmp, to_tmp, comp);
+}
+
+// allocates the buffer of the merge sort
+template <class Iterator, class Compare>
+class sort_top_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  using item_type = value_type_of<Iterator>;
+
+  Iterator first; int n; Compare comp;
+  item_type* tmp;
+
+  sort_top_rec(Iterator first, int n, Compare comp)
+  : first(first), n(n), comp(comp) { }
+
+  encore_dc_declare(encore::edsl, sort_top_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.tmp = new item_type[s.n];
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        return algorithms::sort(st, pt, s.first, s.n, s.tmp, false, s.comp);
+      }),
+      dc::stmt([] (sar& s, par&) {
+        delete [] s.tmp;
+      })
+    });
+  }
+
+};
+
+template <class Iterator, class Compare>
+typename sort_top_rec<Iterator,Compare>::cfg_type sort_top_rec<Iterator,Compare>::cfg = sort_top_rec<Iterator,Compare>::get_cfg();
+
+/*---------------------------------------------------------------------*/
+/* Dedupe */
+
+// sorts a copy of the input, and then packs the first item of each run
+// of equivalent items
+template <class Input, class Output, class Compare>
+class dedupe_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  using item_type = value_type_of<Input>;
+
+  Input first; int n; Output d_first; Compare comp; int* nb_unique;
+  item_type* items;
+
+  dedupe_rec(Input first, int n, Output d_first, Compare comp, int* nb_unique)
+  : first(first), n(n), d_first(d_first), comp(comp), nb_unique(nb_unique) { }
+
+  encore_dc_declare(encore::edsl, dedupe_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par&) {
+        s.items = new item_type[s.n];
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto first = s.first; auto items = s.items;
+        return encore::parallel_for(st, pt, 0, s.n, [=] (int i) {
+          items[i] = first[i];
+        });
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        return edsl::pcfg::push_call<sort_top_rec<item_type*,Compare>>(st, pt, s.items, s.n, s.comp);
+      }),
+      dc::spawn_join([] (sar& s, par&, plt pt, stt st) {
+        auto items = s.items; auto comp = s.comp;
+        return algorithms::pack(st, pt, items, s.n, s.d_first, [=] (int i) mutable {
+          return (i == 0) || comp(items[i - 1], items[i]);
+        }, s.nb_unique);
+      }),
+      dc::stmt([] (sar& s, par&) {
+        delete [] s.items;
+      })
+    });
+  }
+
+};
+
+template <class Input, class Output, class Compare>
+typename dedupe_rec<Input,Output,Compare>::cfg_type dedupe_rec<Input,Output,Compare>::cfg = dedupe_rec<Input,Output,Compare>::get_cfg();
+
+} // end namespace
+
+/*---------------------------------------------------------------------*/
+/* Interface */
+
+// writes to [d_first, d_first + (last - first)) the exclusive prefix
+// sums, by combine and from init, of [first, last), and to *total, if
+// total is not null, the sum of all of them; d_first may be first
+template <class Input, class Output, class Item, class Combine>
+stack_type scan(stack_type st, parent_link_type p, Input first, Input last, Output d_first,
+                Item init, Combine combine, Item* total = nullptr) {
+  return algorithms::scan(st, p, first, (int)(last - first), d_first, init, combine, total);
+}
+
+template <class Input, class Output, class Item, class Combine>
+stack_type scan(stack_type st, Input first, Input last, Output d_first,
+                Item init, Combine combine, Item* total = nullptr) {
+  return scan(st, edsl::pcfg::cactus::Parent_link_sync, first, last, d_first, init, combine, total);
+}
+
+// copies to d_first, in order, the items first[i] of [first, last) for
+// which flags[i] holds, and writes their number to *nb_kept
+template <class Input, class Flags, class Output>
+stack_type pack(stack_type st, parent_link_type p, Input first, Input last, Flags flags,
+                Output d_first, int* nb_kept) {
+  return algorithms::pack(st, p, first, (int)(last - first), d_first, [=] (int i) {
+    return (bool)flags[i];
+  }, nb_kept);
+}
+
+template <class Input, class Flags, class Output>
+stack_type pack(stack_type st, Input first, Input last, Flags flags,
+                Output d_first, int* nb_kept) {
+  return pack(st, edsl::pcfg::cactus::Parent_link_sync, first, last, flags, d_first, nb_kept);
+}
+
+// copies to d_first, in order, the items x of [first, last) for which
+// pred(x) holds, and writes their number to *nb_kept
+template <class Input, class Output, class Predicate>
+stack_type filter(stack_type st, parent_link_type p, Input first, Input last,
+                  Output d_first, Predicate pred, int* nb_kept) {
+  return algorithms::pack(st, p, first, (int)(last - first), d_first, [=] (int i) mutable {
+    return (bool)pred(first[i]);
+  }, nb_kept);
+}
+
+template <class Input, class Output, class Predicate>
+stack_type filter(stack_type st, Input first, Input last,
+                  Output d_first, Predicate pred, int* nb_kept) {
+  return filter(st, edsl::pcfg::cactus::Parent_link_sync, first, last, d_first, pred, nb_kept);
+}
+
+// merges the sorted ranges [first1, last1) and [first2, last2) into
+// d_first, stably, as std::merge does
+template <class Input1, class Input2, class Output,
+          class Compare = std::less<algorithms::value_type_of<Input1>>>
+stack_type merge(stack_type st, parent_link_type p, Input1 first1, Input1 last1,
+                 Input2 first2, Input2 last2, Output d_first, Compare comp = Compare()) {
+  return algorithms::merge(st, p, first1, last1, first2, last2, d_first, comp);
+}
+
+template <class Input1, class Input2, class Output,
+          class Compare = std::less<algorithms::value_type_of<Input1>>>
+stack_type merge(stack_type st, Input1 first1, Input1 last1,
+                 Input2 first2, Input2 last2, Output d_first, Compare comp = Compare()) {
+  return merge(st, edsl::pcfg::cactus::Parent_link_sync, first1, last1, first2, last2, d_first, comp);
+}
+
+// sorts [first, last) in place, stably, by a parallel merge sort that
+// uses a buffer of last - first items
+template <class Iterator,
+          class Compare = std::less<algorithms::value_type_of<Iterator>>>
+stack_type sort(stack_type st, parent_link_type p, Iterator first, Iterator last,
+                Compare comp = Compare()) {
+  using rec = algorithms::sort_top_rec<Iterator,Compare>;
+  return edsl::pcfg::push_call<rec>(st, p, first, (int)(last - first), comp);
+}
+
+template <class Iterator,
+          class Compare = std::less<algorithms::value_type_of<Iterator>>>
+stack_type sort(stack_type st, Iterator first, Iterator last, Compare comp = Compare()) {
+  return sort(st, edsl::pcfg::cactus::Parent_link_sync, first, last, comp);
+}
+
+// copies to d_first the distinct items of [first, last), i.e., one item
+// of each class of equivalent items, in sorted order, and writes their
+// number to *nb_unique
+template <class Input, class Output,
+          class Compare = std::less<algorithms::value_type_of<Input>>>
+stack_type dedupe(stack_type st, parent_link_type p, Input first, Input last,
+                  Output d_first, int* nb_unique, Compare comp = Compare()) {
+  using rec = algorithms::dedupe_rec<Input,Output,Compare>;
+  return edsl::pcfg::push_call<rec>(st, p, first, (int)(last - first), d_first, comp, nb_unique);
+}
+
+template <class Input, class Output,
+          class Compare = std::less<algorithms::value_type_of<Input>>>
+stack_type dedupe(stack_type st, Input first, Input last,
+                  Output d_first, int* nb_unique, Compare comp = Compare()) {
+  return dedupe(st, edsl::pcfg::cactus::Parent_link_sync, first, last, d_first, nb_unique, comp);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_ALGORITHMS_H_ */
@@ -0,0 +1,318 @@
+#include <assert.h>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "perworker.hpp"
+#include "cycles.hpp"
+#include "fuel.hpp"
+#include "stats.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+#include "future.hpp"
+
+#ifndef _ENCORE_BAG_H_
+#define _ENCORE_BAG_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Concurrent bag
+ *
+ * A bag is an unordered collection of items into which workers insert
+ * concurrently. Each worker inserts into a list of chunks of its own,
+ * so that inserts are not synchronized, and the lists of two bags are
+ * merged by splicing, in time that does not depend on the number of
+ * items. Inserts are to be called by code that runs on a worker, and
+ * the other operations are not to run concurrently with inserts.
+ *
+ * parallel_for_each(b, body) moves the items out of b, and runs
+ * body(x) on each of them, in parallel: the chunks of b are split among
+ * vertices at heartbeats, the way a frontier is split by strands. The
+ * body may insert into any bag, b included, e.g., to produce the work
+ * of the next round without rebuilding an array of pending items:
+ *
+ *   bag<int> current, next;
+ *   ...
+ *   auto done = parallel_for_each(current, [&] (int& x) {
+ *     if (...) {
+ *       next.insert(x);
+ *     }
+ *   });
+ */
+
+namespace bags {
+
+static constexpr
+int chunk_capacity = 512;
+
+template <class Item>
+class chunk {
+public:
+
+  std::vector<Item> items;
+
+  chunk* next = nullptr;
+
+  chunk() {
+    items.reserve(chunk_capacity);
+  }
+
+  bool is_full() const {
+    return (int)items.size() == chunk_capacity;
+  }
+
+};
+
+// a singly-linked list of chunks, whose last chunk is the one that is
+// filled by inserts
+template <class Item>
+class chunk_list {
+public:
+
+  using chunk_type = chunk<Item>;
+
+  chunk_type* head = nullptr;
+
+  chunk_type* tail = nullptr;
+
+  long nb_items = 0;
+
+  chunk_list() { }
+
+  chunk_list(const chunk_list&) = delete;
+
+  chunk_list& operator=(const chunk_list&) = delete;
+
+  chunk_list(chunk_list&& other) {
+    swap(other);
+  }
+
+  ~chunk_list() {
+    clear();
+  }
+
+  void swap(chunk_list& other) {
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(nb_items, other.nb_items);
+  }
+
+  void clear() {
+    chunk_type* c = head;
+    while (c != nullptr) {
+      chunk_type* n = c->next;
+      delete c;
+      c = n;
+    }
+    head = nullptr;
+    tail = nullptr;
+    nb_items = 0;
+  }
+
+  void push_back(const Item& x) {
+    if ((tail == nullptr) || tail->is_full()) {
+      auto c = new chunk_type;
+      if (tail == nullptr) {
+        head = c;
+      } else {
+        tail->next = c;
+      }
+      tail = c;
+    }
+    tail->items.push_back(x);
+    nb_items++;
+  }
+
+  // moves the chunks of other to the front of this list, so that the
+  // last chunk of this list remains the one that is being filled
+  void splice(chunk_list& other) {
+    if (other.head == nullptr) {
+      return;
+    }
+    other.tail->next = head;
+    head = other.head;
+    if (tail == nullptr) {
+      tail = other.tail;
+    }
+    nb_items += other.nb_items;
+    other.head = nullptr;
+    other.tail = nullptr;
+    other.nb_items = 0;
+  }
+
+};
+
+} // end namespace
+
+template <class Item>
+class bag {
+public:
+
+  using chunk_list_type = bags::chunk_list<Item>;
+
+private:
+
+  data::perworker::array<chunk_list_type> lists;
+
+public:
+
+  bag() { }
+
+  bag(const bag&) = delete;
+
+  bag& operator=(const bag&) = delete;
+
+  void insert(const Item& x) {
+    lists.mine().push_back(x);
+  }
+
+  long size() {
+    long nb = 0;
+    lists.for_each([&] (int, chunk_list_type& l) {
+      nb += l.nb_items;
+    });
+    return nb;
+  }
+
+  bool empty() {
+    return size() == 0;
+  }
+
+  void clear() {
+    lists.for_each([&] (int, chunk_list_type& l) {
+      l.clear();
+    });
+  }
+
+  // moves the items of other to this bag
+  void merge(bag& other) {
+    for (int i = 0; i < data::perworker::get_nb_workers(); i++) {
+      lists[i].splice(other.lists[i]);
+    }
+  }
+
+  // moves the items of this bag to the returned list
+  chunk_list_type take() {
+    chunk_list_type result;
+    for (int i = 0; i < data::perworker::get_nb_workers(); i++) {
+      result.splice(lists[i]);
+    }
+    return result;
+  }
+
+};
+
+namespace bags {
+
+template <class Item, class Body>
+class for_each_shared {
+public:
+
+  chunk_list<Item> chunks;
+
+  std::vector<chunk<Item>*> index;
+
+  Body body;
+
+  sched::vertex* join;
+
+  for_each_shared(chunk_list<Item>&& cs, const Body& body)
+  : chunks(std::move(cs)), body(body) {
+    for (auto c = chunks.head; c != nullptr; c = c->next) {
+      if (! c->items.empty()) {
+        index.push_back(c);
+      }
+    }
+  }
+
+};
+
+// runs the body on the items of the chunks [lo, hi) of the index,
+// starting from item pos of chunk lo; each chunk is one strand
+template <class Item, class Body>
+class for_each_vertex : public sched::vertex {
+private:
+
+  using shared_type = for_each_shared<Item, Body>;
+
+  std::shared_ptr<shared_type> shared;
+
+  int lo; int hi;
+
+  int pos = 0;
+
+public:
+
+  for_each_vertex(std::shared_ptr<shared_type> shared, int lo, int hi)
+  : shared(shared), lo(lo), hi(hi) { }
+
+  int nb_strands() {
+    return hi - lo;
+  }
+
+  fuel::check_type run() {
+    auto& s = *shared;
+    while (lo < hi) {
+      auto& items = s.index[lo]->items;
+      int n = (int)items.size();
+      while (pos < n) {
+        s.body(items[pos]);
+        pos++;
+        if ((fuel::check(cycles::now()) == fuel::check_yes_promote) && (nb_strands() >= 2)) {
+          auto r = split(nb_strands() / 2);
+          sched::schedule(r.v2);
+          sched::schedule(r.v1);
+          stats::on_promotion();
+          return fuel::check_yes_promote;
+        }
+      }
+      lo++;
+      pos = 0;
+    }
+    return fuel::check_no_promote;
+  }
+
+  // the new vertex takes the last nb chunks, as for the loops of the
+  // interpreter, and this vertex keeps the others
+  sched::vertex_split_type split(int nb) {
+    assert((nb > 0) && (nb < nb_strands()));
+    int mid = hi - nb;
+    auto v = new for_each_vertex(shared, mid, hi);
+    hi = mid;
+    v->get_outset()->make_unary();
+    sched::new_edge(v, shared->join);
+    v->make_ready();
+    return sched::make_vertex_split(this, v);
+  }
+
+};
+
+} // end namespace
+
+// runs body(x) on each item x of b, in parallel, and returns a future
+// that is set once all are done; the items are moved out of b first
+template <class Item, class Body>
+future<void> parallel_for_each(bag<Item>& b, const Body& body) {
+  auto shared = std::make_shared<bags::for_each_shared<Item, Body>>(b.take(), body);
+  auto result = std::make_shared<futures::state_type<void>>();
+  // the chunks are released once the join runs
+  auto f = [shared] { };
+  auto join = new futures::compute_vertex<void, decltype(f)>(result, f);
+  result->control = join->get_outset()->make_chain_future();
+  shared->join = join;
+  int nb = (int)shared->index.size();
+  if (nb > 0) {
+    auto v = new bags::for_each_vertex<Item, Body>(shared, 0, nb);
+    v->get_outset()->make_unary();
+    sched::new_edge(v, join);
+    sched::release(v);
+  }
+  sched::release(join);
+  return future<void>(result);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_BAG_H_ */
@@ -0,0 +1,275 @@
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "atomic.hpp"
+#include "perworker.hpp"
+#include "cmdline.hpp"
+#include "machine.hpp"
+
+#ifndef _ENCORE_BLOCKPROFILE_H_
+#define _ENCORE_BLOCKPROFILE_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Per-basic-block cycle profiler
+ *
+ * When active (-profile_blocks), the interpreter charges the cycles
+ * of each block that it runs to a per-worker table that is keyed by
+ * the control-flow graph of the activation record and by the label of
+ * the block. The profiler also counts, for each block, the number of
+ * executions, the number of promotions that were taken at that block,
+ * and the transitions that were taken from the block. At exit, the
+ * tables of all workers are merged, and the hottest blocks are
+ * reported. If -profile_blocks_dot is given, a DOT graph of each
+ * control-flow graph, annotated with the measurements, is written to
+ * the given file.
+ */
+
+template <bool enabled>
+class block_profile_base {
+private:
+
+  class block_record {
+  public:
+    int tag = -1;
+    uint64_t nb_cycles = 0;
+    uint64_t nb_executions = 0;
+    uint64_t nb_promotions = 0;
+  };
+
+  class cfg_record {
+  public:
+    const char* name = nullptr;
+    std::vector<block_record> blocks;
+    // key: (pred + 1) * (nb_blocks + 1) + (succ + 1)
+    std::unordered_map<int64_t, uint64_t> edges;
+
+    template <class Shared_activation_record>
+    void resize(Shared_activation_record& sar, int nb_blocks) {
+      if (name == nullptr) {
+        name = sar.get_name();
+      }
+      if (blocks.size() < nb_blocks) {
+        blocks.resize(nb_blocks);
+      }
+    }
+
+    void resize(const char* _name, int nb_blocks) {
+      if (name == nullptr) {
+        name = _name;
+      }
+      if (blocks.size() < nb_blocks) {
+        blocks.resize(nb_blocks);
+      }
+    }
+
+    int64_t key_of_edge(int pred, int succ) const {
+      int64_t n = (int64_t)blocks.size() + 1;
+      return ((int64_t)pred + 1) * n + ((int64_t)succ + 1);
+    }
+
+    std::pair<int, int> edge_of_key(int64_t key) const {
+      int64_t n = (int64_t)blocks.size() + 1;
+      return std::make_pair((int)(key / n) - 1, (int)(key % n) - 1);
+    }
+
+  };
+
+  using table_type = std::unordered_map<const void*, cfg_record>;
+
+  static
+  data::perworker::array<table_type> tables;
+
+  static
+  bool active;
+
+  static
+  const char* name_of_tag(int tag) {
+    static const char* names[] = {
+      "unconditional_jump", "conditional_jump",
+      "spawn_join", "spawn2_join",
+      "tail",
+      "join_plus", "spawn_minus",
+      "spawn_plus", "join_minus",
+      "none"
+    };
+    if ((tag < 0) || (tag >= (int)(sizeof(names) / sizeof(names[0])))) {
+      return "unknown";
+    }
+    return names[tag];
+  }
+
+  static
+  table_type merge() {
+    table_type result;
+    for (auto id = 0; id != data::perworker::get_nb_workers(); id++) {
+      for (auto& p : tables[id]) {
+        cfg_record& src = p.second;
+        cfg_record& dst = result[p.first];
+        dst.resize(src.name, (int)src.blocks.size());
+        for (int i = 0; i < src.blocks.size(); i++) {
+          block_record& b = dst.blocks[i];
+          if (src.blocks[i].tag != -1) {
+            b.tag = src.blocks[i].tag;
+          }
+          b.nb_cycles += src.blocks[i].nb_cycles;
+          b.nb_executions += src.blocks[i].nb_executions;
+          b.nb_promotions += src.blocks[i].nb_promotions;
+        }
+        for (auto& e : src.edges) {
+          auto pq = src.edge_of_key(e.first);
+          dst.edges[dst.key_of_edge(pq.first, pq.second)] += e.second;
+        }
+      }
+    }
+    return result;
+  }
+
+  static
+  void output_dot(table_type& t, std::string fname) {
+    FILE* f = fopen(fname.c_str(), "w");
+    if (f == nullptr) {
+      atomic::die("failed to open %s\n", fname.c_str());
+    }
+    int i = 0;
+    for (auto& p : t) {
+      cfg_record& c = p.second;
+      fprintf(f, "digraph cfg%d {\n", i);
+      fprintf(f, "  label=\"%s\";\n", c.name);
+      fprintf(f, "  node [shape=box];\n");
+      for (int l = 0; l < c.blocks.size(); l++) {
+        block_record& b = c.blocks[l];
+        fprintf(f, "  b%d [label=\"%d: %s\\n%.3lf usec\\n%llu execs\\n%llu promotions\"];\n",
+                l, l, name_of_tag(b.tag),
+                machine::microseconds_of_cycles(b.nb_cycles),
+                (unsigned long long)b.nb_executions,
+                (unsigned long long)b.nb_promotions);
+      }
+      fprintf(f, "  exit [shape=doublecircle];\n");
+      for (auto& e : c.edges) {
+        auto pq = c.edge_of_key(e.first);
+        if (pq.second == -1) {
+          fprintf(f, "  b%d -> exit [label=\"%llu\"];\n", pq.first, (unsigned long long)e.second);
+        } else {
+          fprintf(f, "  b%d -> b%d [label=\"%llu\"];\n", pq.first, pq.second, (unsigned long long)e.second);
+        }
+      }
+      fprintf(f, "}\n");
+      i++;
+    }
+    fclose(f);
+  }
+
+public:
+
+  static
+  void initialize() {
+    if (! enabled) {
+      return;
+    }
+    active = deepsea::cmdline::parse_or_default_bool("profile_blocks", false);
+    tables.for_each([&] (int, table_type& t) {
+      t.clear();
+    });
+  }
+
+  // to be called each time the block labeled pred, of tag tag, in the
+  // control-flow graph cfg of sar, runs for elapsed cycles and hands
+  // control to the block labeled succ
+  template <class Shared_activation_record>
+  static inline
+  void on_block(const void* cfg, Shared_activation_record& sar, int nb_blocks,
+                int pred, int tag, int succ, uint64_t elapsed) {
+    if ((! enabled) || (! active)) {
+      return;
+    }
+    cfg_record& c = tables.mine()[cfg];
+    c.resize(sar, nb_blocks);
+    block_record& b = c.blocks[pred];
+    b.tag = tag;
+    b.nb_cycles += elapsed;
+    b.nb_executions++;
+    c.edges[c.key_of_edge(pred, succ)]++;
+  }
+
+  // to be called each time latent parallelism is promoted at the block
+  // labeled label
+  template <class Shared_activation_record>
+  static inline
+  void on_promotion(const void* cfg, Shared_activation_record& sar, int nb_blocks, int label) {
+    if ((! enabled) || (! active)) {
+      return;
+    }
+    cfg_record& c = tables.mine()[cfg];
+    c.resize(sar, nb_blocks);
+    c.blocks[label].nb_promotions++;
+  }
+
+  static
+  void report() {
+    if ((! enabled) || (! active)) {
+      return;
+    }
+    table_type t = merge();
+    class row_type {
+    public:
+      const char* name;
+      int label;
+      block_record b;
+    };
+    std::vector<row_type> rows;
+    uint64_t total = 0;
+    for (auto& p : t) {
+      for (int l = 0; l < p.second.blocks.size(); l++) {
+        block_record& b = p.second.blocks[l];
+        if (b.nb_executions == 0) {
+          continue;
+        }
+        rows.push_back({ p.second.name, l, b });
+        total += b.nb_cycles;
+      }
+    }
+    std::sort(rows.begin(), rows.end(), [] (const row_type& r1, const row_type& r2) {
+      return r1.b.nb_cycles > r2.b.nb_cycles;
+    });
+    int nb_rows = deepsea::cmdline::parse_or_default("profile_blocks_top", 20);
+    nb_rows = std::min(nb_rows, (int)rows.size());
+    printf("hot_blocks\n");
+    printf("%%time\tusec\texecs\tpromotions\tlabel\ttag\tname\n");
+    for (int i = 0; i < nb_rows; i++) {
+      row_type& r = rows[i];
+      double pct = (total == 0) ? 0.0 : (100.0 * r.b.nb_cycles) / total;
+      printf("%.2lf\t%.3lf\t%llu\t%llu\t%d\t%s\t%s\n",
+             pct, machine::microseconds_of_cycles(r.b.nb_cycles),
+             (unsigned long long)r.b.nb_executions,
+             (unsigned long long)r.b.nb_promotions,
+             r.label, name_of_tag(r.b.tag), r.name);
+    }
+    std::string fname = deepsea::cmdline::parse_or_default_string("profile_blocks_dot", "");
+    if (fname != "") {
+      output_dot(t, fname);
+    }
+  }
+
+};
+
+template <bool enabled>
+data::perworker::array<typename block_profile_base<enabled>::table_type> block_profile_base<enabled>::tables;
+
+template <bool enabled>
+bool block_profile_base<enabled>::active = false;
+
+#ifdef ENCORE_ENABLE_PROFILING
+using block_profile = block_profile_base<true>;
+#else
+using block_profile = block_profile_base<false>;
+#endif
+
+} // end namespace
+
+#endif /*! _ENCORE_BLOCKPROFILE_H_ */
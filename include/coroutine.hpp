@@ -0,0 +1,453 @@
+#include <assert.h>
+#include <cstddef>
+#include <cstdio>
+#include <chrono>
+#include <deque>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+#include "perworker.hpp"
+#include "atomic.hpp"
+#include "cycles.hpp"
+#include "fuel.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L) && __has_include(<coroutine>)
+#define ENCORE_HAVE_COROUTINES
+#include <coroutine>
+#endif
+
+#ifndef _ENCORE_COROUTINE_H_
+#define _ENCORE_COROUTINE_H_
+
+#ifdef ENCORE_HAVE_COROUTINES
+
+namespace encore {
+namespace coroutine {
+
+/*---------------------------------------------------------------------*/
+/* Coroutine frontend
+ *
+ * An alternative to the DSL, available when compiling with C++20
+ * coroutines (e.g., -std=gnu++20), in which a task is a coroutine that
+ * returns a coroutine::task:
+ *
+ *   coroutine::task fib(int n, int* dst) {
+ *     if (n <= 1) {
+ *       *dst = n;
+ *       co_return;
+ *     }
+ *     int d1, d2;
+ *     co_await coroutine::fork2(fib(n - 1, &d1), fib(n - 2, &d2));
+ *     *dst = d1 + d2;
+ *   }
+ *
+ * A vertex (vertex_type) runs a chain of coroutines, each of which is
+ * suspended at the point where it awaits the next one, by resuming the
+ * newest one. Like dc::spawn2_join, co_await fork2(a, b) is latent
+ * parallelism: it runs a and then b, sequentially, in the vertex of
+ * the caller, but it is recorded as a mark of the vertex for as long
+ * as a runs. At a heartbeat, which is polled at each fork2, the vertex
+ * promotes its oldest mark: the coroutines of the first branch move to
+ * a new vertex, the second branch is started in another new vertex,
+ * and the vertex of the caller waits for both, and then resumes the
+ * caller.
+ *
+ * Coroutine frames are allocated from per-worker pools (see below).
+ */
+
+/*---------------------------------------------------------------------*/
+/* Frame pool
+ *
+ * Frames are rounded up to a power of two number of bytes; each worker
+ * keeps, for each size, a list of at most frame_cache_capacity free
+ * frames. A frame that is freed by a worker other than the one that
+ * allocated it, which happens to frames that are moved by promotions,
+ * goes to the cache of the worker that frees it. Frames that are larger
+ * than the largest size go to the system allocator.
+ */
+
+static constexpr
+int nb_frame_size_classes = 8;
+
+static constexpr
+std::size_t min_frame_szb = 64;
+
+static constexpr
+int frame_cache_capacity = 256;
+
+class free_frame_type {
+public:
+  free_frame_type* next;
+};
+
+class frame_cache_type {
+public:
+  free_frame_type* heads[nb_frame_size_classes] = { nullptr };
+  int sizes[nb_frame_size_classes] = { 0 };
+};
+
+data::perworker::array<frame_cache_type> frame_caches;
+
+static inline
+int size_class_of(std::size_t szb) {
+  int c = 0;
+  while ((c < nb_frame_size_classes) && ((min_frame_szb << c) < szb)) {
+    c++;
+  }
+  return c;
+}
+
+static inline
+void* allocate_frame(std::size_t szb) {
+  int c = size_class_of(szb);
+  if (c == nb_frame_size_classes) {
+    return ::operator new(szb);
+  }
+  frame_cache_type& fc = frame_caches.mine();
+  free_frame_type* f = fc.heads[c];
+  if (f == nullptr) {
+    return ::operator new(min_frame_szb << c);
+  }
+  fc.heads[c] = f->next;
+  fc.sizes[c]--;
+  return f;
+}
+
+static inline
+void deallocate_frame(void* p, std::size_t szb) {
+  int c = size_class_of(szb);
+  frame_cache_type& fc = frame_caches.mine();
+  if ((c == nb_frame_size_classes) || (fc.sizes[c] == frame_cache_capacity)) {
+    ::operator delete(p);
+    return;
+  }
+  free_frame_type* f = (free_frame_type*)p;
+  f->next = fc.heads[c];
+  fc.heads[c] = f;
+  fc.sizes[c]++;
+}
+
+/*---------------------------------------------------------------------*/
+/* Tasks */
+
+class fork2_awaiter;
+
+std::coroutine_handle<> on_first_branch_completed(fork2_awaiter* fork);
+
+std::coroutine_handle<> on_root_completed();
+
+class task {
+public:
+
+  class promise_type;
+
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  class final_awaiter {
+  public:
+
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+      promise_type& p = h.promise();
+      if (p.fork != nullptr) {
+        return on_first_branch_completed(p.fork);
+      } else if (p.continuation) {
+        return p.continuation;
+      } else {
+        return on_root_completed();
+      }
+    }
+
+    void await_resume() noexcept { }
+
+  };
+
+  class promise_type {
+  public:
+
+    // the coroutine that awaits this task, if any
+    std::coroutine_handle<> continuation;
+
+    // the fork, if this task is the first branch of a fork2
+    fork2_awaiter* fork = nullptr;
+
+    task get_return_object() {
+      return task(handle_type::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return { };
+    }
+
+    final_awaiter final_suspend() noexcept {
+      return { };
+    }
+
+    void return_void() { }
+
+    void unhandled_exception() {
+      atomic::die("unhandled exception in coroutine\n");
+    }
+
+    static
+    void* operator new(std::size_t szb) {
+      return allocate_frame(szb);
+    }
+
+    static
+    void operator delete(void* p, std::size_t szb) {
+      deallocate_frame(p, szb);
+    }
+
+  };
+
+  handle_type h;
+
+  task() { }
+
+  explicit task(handle_type h)
+  : h(h) { }
+
+  task(const task&) = delete;
+
+  task& operator=(const task&) = delete;
+
+  task(task&& other)
+  : h(other.h) {
+    other.h = nullptr;
+  }
+
+  task& operator=(task&& other) {
+    if (this != &other) {
+      if (h) {
+        h.destroy();
+      }
+      h = other.h;
+      other.h = nullptr;
+    }
+    return *this;
+  }
+
+  ~task() {
+    if (h) {
+      h.destroy();
+    }
+  }
+
+  // co_await t runs t, sequentially, and then resumes the caller
+
+  bool await_ready() {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    h.promise().continuation = caller;
+    return h;
+  }
+
+  void await_resume() { }
+
+};
+
+/*---------------------------------------------------------------------*/
+/* Vertex */
+
+class vertex_type : public sched::vertex {
+public:
+
+  // the coroutine to resume next, or null once the vertex has completed
+  std::coroutine_handle<> current;
+
+  // the task that the vertex was created for, if the vertex owns it
+  task root;
+
+  // the forks that are in progress in this vertex, oldest first
+  std::deque<fork2_awaiter*> marks;
+
+  bool heartbeat = false;
+
+  vertex_type(task&& t)
+  : root(std::move(t)) {
+    current = root.h;
+  }
+
+  vertex_type(std::coroutine_handle<> h)
+  : current(h) { }
+
+  int nb_strands() {
+    return current ? 1 : 0;
+  }
+
+  fuel::check_type run() {
+    while (current && (! heartbeat)) {
+      std::coroutine_handle<> h = current;
+      current = nullptr;
+      h.resume();
+    }
+    if (! heartbeat) {
+      return fuel::check_no_promote;
+    }
+    heartbeat = false;
+    promote();
+    return fuel::check_yes_promote;
+  }
+
+  void promote();
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+static inline
+vertex_type* my_vertex() {
+  return (vertex_type*)sched::my_vertex();
+}
+
+std::coroutine_handle<> on_root_completed() {
+  // the vertex completes, as it has no current coroutine left
+  return std::noop_coroutine();
+}
+
+/*---------------------------------------------------------------------*/
+/* Fork join */
+
+class fork2_awaiter {
+public:
+
+  task branch1;
+  task branch2;
+
+  std::coroutine_handle<> caller;
+
+  bool promoted = false;
+
+  fork2_awaiter(task&& branch1, task&& branch2)
+  : branch1(std::move(branch1)), branch2(std::move(branch2)) { }
+
+  bool await_ready() {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    this->caller = caller;
+    branch1.h.promise().fork = this;
+    vertex_type* v = my_vertex();
+    v->marks.push_back(this);
+    if (fuel::check(cycles::now()) == fuel::check_yes_promote) {
+      // return to the vertex, which promotes its oldest mark, and then
+      // starts the first branch
+      v->current = branch1.h;
+      v->heartbeat = true;
+      return std::noop_coroutine();
+    }
+    return branch1.h;
+  }
+
+  void await_resume() { }
+
+};
+
+std::coroutine_handle<> on_first_branch_completed(fork2_awaiter* fork) {
+  if (fork->promoted) {
+    // the first branch runs in a vertex of its own, which completes
+    return std::noop_coroutine();
+  }
+  vertex_type* v = my_vertex();
+  assert(v->marks.back() == fork);
+  v->marks.pop_back();
+  fork->branch2.h.promise().continuation = fork->caller;
+  return fork->branch2.h;
+}
+
+// runs branch1 and branch2 in parallel, and then resumes the caller
+static inline
+fork2_awaiter fork2(task&& branch1, task&& branch2) {
+  return fork2_awaiter(std::move(branch1), std::move(branch2));
+}
+
+void vertex_type::promote() {
+  if (marks.empty()) {
+    sched::schedule(this);
+    return;
+  }
+  fork2_awaiter* fork = marks.front();
+  marks.pop_front();
+  fork->promoted = true;
+  vertex_type* join = this;
+  // the newer marks are those of the coroutines of the first branch
+  vertex_type* branch1 = new vertex_type(current);
+  branch1->marks.swap(marks);
+  vertex_type* branch2 = new vertex_type(fork->branch2.h);
+  join->current = fork->caller;
+  branch1->get_outset()->make_unary();
+  branch2->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+  profile::on_promotion(join->span, branch1->span);
+  profile::on_promotion(join->span, branch2->span);
+#endif
+  sched::new_edge(branch2, join);
+  sched::new_edge(branch1, join);
+  sched::release(branch2);
+  sched::release(branch1);
+  stats::on_promotion();
+}
+
+/*---------------------------------------------------------------------*/
+/* Parallel loops */
+
+// default number of iterations below which a loop is not split
+int loop_grain = 256;
+
+template <class Body>
+task parallel_for_rec(int lo, int hi, const Body* body, int grain) {
+  if (hi - lo <= grain) {
+    for (int i = lo; i < hi; i++) {
+      if constexpr (std::is_same<decltype((*body)(i)), task>::value) {
+        co_await (*body)(i);
+      } else {
+        (*body)(i);
+      }
+    }
+    co_return;
+  }
+  int mid = lo + (hi - lo) / 2;
+  co_await fork2(parallel_for_rec(lo, mid, body, grain),
+                 parallel_for_rec(mid, hi, body, grain));
+}
+
+// runs body(i), or, if it returns a task, co_await body(i), for each i
+// in [lo, hi), by binary splitting down to grain iterations
+template <class Body>
+task parallel_for(int lo, int hi, Body body, int grain = loop_grain) {
+  co_await parallel_for_rec(lo, hi, &body, std::max(1, grain));
+}
+
+/*---------------------------------------------------------------------*/
+/* Entry point */
+
+task run_and_report_elapsed(task t) {
+  auto start = std::chrono::system_clock::now();
+  co_await t;
+  auto end = std::chrono::system_clock::now();
+  std::chrono::duration<float> diff = end - start;
+  printf ("exectime %.3lf\n", diff.count());
+  sched::should_exit = true;
+}
+
+} // end namespace
+} // end namespace
+
+#endif
+
+#endif /*! _ENCORE_COROUTINE_H_ */
@@ -1,4 +1,7 @@
 
+#include <cstdint>
+#include <time.h>
+
 #ifndef _ENCORE_CYCLES_H_
 #define _ENCORE_CYCLES_H_
 
@@ -22,8 +25,20 @@ void rdtsc_wait(uint64_t n) {
   }
 }
   
+static inline
+uint64_t monotonic_clock_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+  
 } // end namespace
   
+// when set (on machines without an invariant TSC), the cycle counter is
+// emulated by CLOCK_MONOTONIC_RAW, at one tick per nanosecond; see
+// machine::initialize_cpuinfo
+bool use_monotonic_clock = false;
+  
 static inline
 uint64_t diff(uint64_t start, uint64_t finish) {
   return finish - start;
@@ -31,6 +46,9 @@ uint64_t diff(uint64_t start, uint64_t finish) {
 
 static inline
 uint64_t now() {
+  if (use_monotonic_clock) {
+    return monotonic_clock_nsec();
+  }
   return rdtsc();
 }
 
@@ -41,6 +59,13 @@ uint64_t since(uint64_t start) {
 
 static inline
 void spin_for(uint64_t nb_cycles) {
+  if (use_monotonic_clock) {
+    const uint64_t start = now();
+    while (now() < (start + nb_cycles)) {
+      __asm__("PAUSE");
+    }
+    return;
+  }
   rdtsc_wait(nb_cycles);
 }
   
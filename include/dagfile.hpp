@@ -0,0 +1,52 @@
+#include <cstdint>
+
+#ifndef _ENCORE_DAGFILE_H_
+#define _ENCORE_DAGFILE_H_
+
+namespace encore {
+namespace dagfile {
+
+/*---------------------------------------------------------------------*/
+/* Layout of a recorded computation DAG
+ *
+ * A file consists of a header, followed by nb_nodes node records and
+ * then by nb_edges edge records. Node identifiers are in the range
+ * [1, nb_ids). A node is a piece of sequential work of a vertex,
+ * delimited by the promotions and the dependency edges that the vertex
+ * takes part in; its work is given in cycles. Identifiers that have no
+ * node record denote nodes of zero work.
+ *
+ * This header is shared with the offline simulator, and so depends
+ * only on the standard library.
+ */
+
+static constexpr
+uint64_t magic = 0x454e434441473031; // "ENCDAG01"
+
+class header_type {
+public:
+  uint64_t magic;
+  uint64_t nb_ids;
+  uint64_t nb_nodes;
+  uint64_t nb_edges;
+  double cpu_frequency_ghz;
+  // number of workers of the recorded run
+  uint64_t nb_workers;
+};
+
+class node_type {
+public:
+  uint64_t id;
+  uint64_t work;
+};
+
+class edge_type {
+public:
+  uint64_t src;
+  uint64_t dst;
+};
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_DAGFILE_H_ */
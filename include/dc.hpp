@@ -16,6 +16,7 @@
 #include "pcfg.hpp"
 #include "cycles.hpp"
 #include "grain.hpp"
+#include "profile.hpp"
 
 #ifndef _ENCORE_DC_H_
 #define _ENCORE_DC_H_
@@ -59,8 +60,8 @@ public:
   using parallel_combining_operator_type = std::function<void(sar_type&, par_type&, par_type&)>;
   using loop_range_getter_type = std::function<std::pair<int*, int*>(sar_type&, par_type&)>;
   using leaf_loop_body_type = std::function<void(sar_type&, par_type&, int, int)>;
-  using profile_prefix_getter_type = std::function<std::pair<uint64_t*, uint64_t*>(sar_type&, par_type&)>;
-  using profile_report_code_type = std::function<void(sar_type&, par_type&, uint64_t, uint64_t)>;
+  using profile_prefix_getter_type = std::function<profile::measurement_type*(sar_type&, par_type&)>;
+  using profile_report_code_type = std::function<void(sar_type&, par_type&, profile::measurement_type)>;
   
   stmt_tag_type tag;
   
@@ -995,24 +996,19 @@ private:
         break;
       }
       case tag_profile_statement: {
-#if 0 //defined(ENCORE_ENABLE_LOGGING)
+#if defined(ENCORE_ENABLE_PROFILING)
         auto start_profiling_label = entry;
         auto body_label = new_label();
         auto end_profiling_label = new_label();
         auto getter = stmt.variant_profile_statement.getter;
         auto start_profiling = [getter] (sar& s, par& p) {
-          auto ws = getter(s, p);
-          *(ws.first) = s.pc.profile.work.load();
-          *(ws.second) = s.pc.profile.span.load();
+          *getter(s, p) = profile::measure(sched::my_vertex()->span);
         };
         add_block(start_profiling_label, bbt::unconditional_jump(start_profiling, body_label));
         result = transform(*stmt.variant_profile_statement.body, body_label, end_profiling_label, loop_exit_block, loop_scope, result);
         auto reporter = stmt.variant_profile_statement.reporter;
         auto end_profiling = [getter, reporter] (sar& s, par& p) {
-          auto ws = getter(s, p);
-          auto work = s.pc.profile.work.load() - *(ws.first);
-          auto span = s.pc.profile.span.load() - *(ws.second);
-          reporter(s, p, work, span);
+          reporter(s, p, profile::since(*getter(s, p), sched::my_vertex()->span));
         };
         add_block(end_profiling_label, bbt::unconditional_jump(end_profiling, exit));
 #else
@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+#ifdef TARGET_LINUX
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "perworker.hpp"
+#include "cmdline.hpp"
+#include "cycles.hpp"
+#include "machine.hpp"
+#include "stats.hpp"
+
+#ifndef _ENCORE_ELASTIC_H_
+#define _ENCORE_ELASTIC_H_
+
+namespace encore {
+namespace elastic {
+
+namespace cmdline = deepsea::cmdline;
+
+/*---------------------------------------------------------------------*/
+/* Elastic worker count
+ *
+ * When -elastic is given, each worker of a frontier-based scheduler
+ * (steal_half_work_stealing or encore_work_stealing) samples, every
+ * -elastic_interval_usec microseconds, the number of involuntary
+ * context switches of its thread and the share of the elapsed time
+ * during which its thread actually ran. A worker that was switched out
+ * by the kernel and that ran for less than -elastic_min_cpu_share of
+ * the interval is competing with co-located load, and retires: it
+ * stops stealing, hands its frontier over to the other workers through
+ * the transfer slots of the scheduler, and then sleeps.
+ *
+ * A retired worker sleeps for -elastic_park_usec microseconds, and
+ * then checks whether capacity came back: it spins for one interval,
+ * and takes the same sample. It rejoins if it was not preempted, and
+ * otherwise sleeps again, twice as long as before, up to max_backoff
+ * doublings. The doublings carry over to the next retirement, unless
+ * the worker completes one interval without being preempted in
+ * between. At least -elastic_min_workers workers remain active at any
+ * time.
+ */
+
+bool enabled = false;
+
+// in cycles
+uint64_t check_interval = 0;
+
+// in cycles
+uint64_t park_interval = 0;
+
+double min_cpu_share = 0.5;
+
+int min_workers = 1;
+
+static constexpr
+int max_backoff = 6;
+
+// granularity at which a sleeping worker checks for termination
+static constexpr
+int park_poll_usec = 500;
+
+class worker_state_type {
+public:
+  // time of the last sample, in cycles
+  uint64_t last_check = 0;
+  // CPU time of the thread at the last sample, in nanoseconds
+  uint64_t last_cpu_time = 0;
+  long last_nb_preemptions = 0;
+  int backoff = 0;
+  bool retiring = false;
+};
+
+data::perworker::array<worker_state_type> worker_states;
+
+// retirements and rejoins are rare, and are serialized by this lock,
+// so that the timeline recorded by the statistics is consistent
+std::mutex nb_active_workers_mutex;
+
+int nb_active_workers = 0;
+
+// returns the CPU time consumed by the calling thread, in nanoseconds
+uint64_t thread_cpu_time() {
+#ifdef TARGET_LINUX
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+// returns the number of times that the calling thread was switched out
+// by the kernel while it was runnable
+long thread_nb_preemptions() {
+#ifdef TARGET_LINUX
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+    return ru.ru_nivcsw;
+  }
+#endif
+  return 0;
+}
+
+void reset_sample(worker_state_type& s) {
+  s.last_check = cycles::now();
+  s.last_cpu_time = thread_cpu_time();
+  s.last_nb_preemptions = thread_nb_preemptions();
+}
+
+// to be called once the scheduler is known; supported is false if
+// the scheduler has no frontiers to hand over
+void initialize(bool supported) {
+  enabled = cmdline::parse_or_default_bool("elastic", false);
+  if (! enabled) {
+    return;
+  }
+  if (! supported) {
+    fprintf(stderr, "warning: -elastic requires a frontier-based scheduler; ignored\n");
+    enabled = false;
+    return;
+  }
+  check_interval = machine::cycles_of_microseconds(cmdline::parse_or_default_double("elastic_interval_usec", 1000.0));
+  park_interval = machine::cycles_of_microseconds(cmdline::parse_or_default_double("elastic_park_usec", 10000.0));
+  min_cpu_share = cmdline::parse_or_default_double("elastic_min_cpu_share", 0.5);
+  min_workers = std::max(1, cmdline::parse_or_default_int("elastic_min_workers", 1));
+}
+
+// to be called before the workers are launched
+void on_enter_launch(int nb_workers) {
+  if (! enabled) {
+    return;
+  }
+  worker_states.for_each([&] (int, worker_state_type& s) {
+    s.backoff = 0;
+    s.retiring = false;
+  });
+  std::lock_guard<std::mutex> lock(nb_active_workers_mutex);
+  nb_active_workers = nb_workers;
+  stats::on_active_workers(nb_active_workers);
+}
+
+// to be called by each worker thread, before it starts working
+void on_enter_worker() {
+  if (! enabled) {
+    return;
+  }
+  reset_sample(worker_states.mine());
+}
+
+static inline
+bool is_retiring() {
+  return enabled && worker_states.mine().retiring;
+}
+
+// takes a sample, and returns true if the calling thread was switched
+// out, and ran for less than min_cpu_share of the time, since the last
+// sample
+bool was_preempted(worker_state_type& s) {
+  uint64_t now = cycles::now();
+  double elapsed = machine::microseconds_of_cycles(now - s.last_check) * 1000.0;
+  uint64_t cpu_time = thread_cpu_time();
+  long nb_preemptions = thread_nb_preemptions();
+  double share = (elapsed > 0.0) ? (double)(cpu_time - s.last_cpu_time) / elapsed : 1.0;
+  bool preempted = (nb_preemptions > s.last_nb_preemptions) && (share < min_cpu_share);
+  s.last_check = now;
+  s.last_cpu_time = cpu_time;
+  s.last_nb_preemptions = nb_preemptions;
+  return preempted;
+}
+
+// takes a sample, and returns true if the calling worker is to retire
+bool sample(worker_state_type& s) {
+  bool preempted = was_preempted(s);
+  if (! preempted) {
+    s.backoff = 0;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(nb_active_workers_mutex);
+  if (nb_active_workers <= min_workers) {
+    return false;
+  }
+  nb_active_workers--;
+  stats::on_active_workers(nb_active_workers);
+  s.retiring = true;
+  return true;
+}
+
+// to be called by each worker in its scheduler loop; returns true if
+// the calling worker is retiring, in which case the worker is to stop
+// acquiring work, to hand its frontier over, and then to call park()
+static inline
+bool should_retire() {
+  if (! enabled) {
+    return false;
+  }
+  worker_state_type& s = worker_states.mine();
+  if (s.retiring) {
+    return true;
+  }
+  if (cycles::since(s.last_check) < check_interval) {
+    return false;
+  }
+  return sample(s);
+}
+
+// to be called by a retiring worker once it holds no more work; sleeps,
+// unless is_finished() becomes true, and then makes the worker active
+// again
+template <class Is_finished>
+void park(const Is_finished& is_finished) {
+  worker_state_type& s = worker_states.mine();
+  assert(s.retiring);
+  while (! is_finished()) {
+    uint64_t duration = park_interval << s.backoff;
+    uint64_t start = cycles::now();
+    while ((! is_finished()) && (cycles::since(start) < duration)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(park_poll_usec));
+    }
+    s.backoff = std::min(s.backoff + 1, max_backoff);
+    // a sleeping thread is never preempted, so that capacity is probed
+    // by spinning for one interval
+    reset_sample(s);
+    while ((! is_finished()) && (cycles::since(s.last_check) < check_interval)) {
+      machine::relax();
+    }
+    if (! was_preempted(s)) {
+      break;
+    }
+  }
+  s.retiring = false;
+  {
+    std::lock_guard<std::mutex> lock(nb_active_workers_mutex);
+    nb_active_workers++;
+    stats::on_active_workers(nb_active_workers);
+  }
+  reset_sample(s);
+}
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_ELASTIC_H_ */
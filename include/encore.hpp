@@ -2,9 +2,21 @@
 #include "machine.hpp"
 #include "scheduler.hpp"
 #include "edsl.hpp"
+#include "parallel.hpp"
+#include "algorithms.hpp"
+#include "coroutine.hpp"
+#include "future.hpp"
+#include "pipeline.hpp"
+#include "rounds.hpp"
+#include "bag.hpp"
+#include "multiqueue.hpp"
+#include "io.hpp"
 #include "cmdline.hpp"
 #include "grain.hpp"
 #include "fuel.hpp"
+#include "accumulator.hpp"
+#include "numaarray.hpp"
+#include "metrics.hpp"
 
 #ifndef _ENCORE_H_
 #define _ENCORE_H_
@@ -19,6 +31,7 @@ public:
   
   Function f;
   std::chrono::time_point<std::chrono::system_clock> start;
+  profile::measurement_type profile_start;
   
   call_and_report_elapsed() { }
   
@@ -34,21 +47,22 @@ public:
         s.start = std::chrono::system_clock::now();
       }),
       dc::profile_statement([] (sar& s, par& p) {
-          auto work = nullptr;
-          auto span = nullptr;
-          return std::make_pair(work, span);
-          
+          return &s.profile_start;
         },
         dc::spawn_join([] (sar& s, par&, plt, stt st) {
           return s.f(st);
         }),
-        [] (sar& s, par& p, uint64_t work, uint64_t span) {
-          /*
-          double ticks_per_second = cpu_frequency_ghz * 1000000000.0;
-          double work_sec = ((double)work) / ticks_per_second;
-          double span_sec = ((double)span) / ticks_per_second;
+        [] (sar& s, par& p, profile::measurement_type m) {
+          double work_sec = machine::seconds_of_cycles(m.work);
+          double span_sec = machine::seconds_of_cycles(m.span);
+          double burdened_span_sec = machine::seconds_of_cycles(m.burdened_span);
+          double parallelism = (m.span == 0) ? 0.0 : ((double)m.work) / ((double)m.span);
+          double burdened_parallelism = (m.burdened_span == 0) ? 0.0 : ((double)m.work) / ((double)m.burdened_span);
           printf("work %.5lf\n", work_sec);
-          printf("span %.5lf\n", span_sec); */
+          printf("span %.5lf\n", span_sec);
+          printf("burdened_span %.5lf\n", burdened_span_sec);
+          printf("parallelism %.3lf\n", parallelism);
+          printf("burdened_parallelism %.3lf\n", burdened_parallelism);
       }),
       dc::stmt([] (sar& s, par&) {
         auto end = std::chrono::system_clock::now();
@@ -67,6 +81,7 @@ typename call_and_report_elapsed<Function>::cfg_type call_and_report_elapsed<Fun
 void initialize_runtime(int argc, char** argv) {
   cmdline::set(argc, argv);
   atomic::init_print_lock();
+  machine::initialize_placement();
   machine::initialize_hwloc();
   machine::initialize_cpuinfo();
   auto scheduler = cmdline::parse_or_default_string("scheduler", "work_stealing");
@@ -83,6 +98,9 @@ void initialize_runtime(int argc, char** argv) {
   } else {
     atomic::die("bogus scheduler\n");
   }
+  io::initialize();
+  elastic::initialize((sched::scheduler == sched::steal_half_work_stealing_tag) ||
+                      (sched::scheduler == sched::encore_work_stealing_tag));
   edsl::pcfg::never_promote = cmdline::parse_or_default_bool("never_promote", edsl::pcfg::never_promote);
   double promotion_threshold_usec = 30.0;
   if (edsl::pcfg::never_promote) {
@@ -101,11 +119,21 @@ template <class Init>
 void launch(int nb_workers, const Init& init) {
   logging::log_buffer::initialize();
   stats::initialize();
+  metrics::publisher::initialize();
+  profile::initialize();
+  block_profile::initialize();
   sched::vertex* v = init();
   stats::on_enter_launch();
+  metrics::publisher::on_enter_launch(nb_workers);
+  machine::on_enter_launch(nb_workers);
+  elastic::on_enter_launch(nb_workers);
   sched::launch_scheduler(nb_workers, v);
+  machine::on_exit_launch();
   stats::on_exit_launch();
+  metrics::publisher::on_exit_launch();
   stats::report();
+  block_profile::report();
+  profile::output_dag();
   logging::log_buffer::output();
   data::perworker::reset();
 }
@@ -115,13 +143,13 @@ void launch(sched::vertex* v, int nb_workers) {
 }
   
 void launch(sched::vertex* v) {
-  launch(v, cmdline::parse_or_default("proc", 1));
+  launch(v, machine::get_nb_workers());
 }
 
 template <class F>
 void launch_interpreter_via_lambda(const F& f) {
   /* thanks to buggy GCC, the code here will crash the compiler...
-  launch(cmdline::parse_or_default("proc", 1), [&] {
+  launch(machine::get_nb_workers(), [&] {
     auto interp = new edsl::pcfg::interpreter<edsl::pcfg::stack_type>;
     auto f = [=] (edsl::pcfg::stack_type st) {
       return edsl::pcfg::push_call<Shared_activation_record>(st, args...);
@@ -131,18 +159,28 @@ void launch_interpreter_via_lambda(const F& f) {
     return interp;
   });
   */
-  int nb_workers = cmdline::parse_or_default("proc", 1);
+  int nb_workers = machine::get_nb_workers();
   logging::log_buffer::initialize();
   stats::initialize();
+  metrics::publisher::initialize();
+  profile::initialize();
+  block_profile::initialize();
   auto interp = new edsl::pcfg::interpreter;
   using t = call_and_report_elapsed<F>;
   interp->stack = edsl::pcfg::push_call<t>(interp->stack,
                                            edsl::pcfg::cactus::Parent_link_sync,
                                            f);
   stats::on_enter_launch();
+  metrics::publisher::on_enter_launch(nb_workers);
+  machine::on_enter_launch(nb_workers);
+  elastic::on_enter_launch(nb_workers);
   sched::launch_scheduler(nb_workers, interp);
+  machine::on_exit_launch();
   stats::on_exit_launch();
+  metrics::publisher::on_exit_launch();
   stats::report();
+  block_profile::report();
+  profile::output_dag();
   logging::log_buffer::output();
   data::perworker::reset();
 }
@@ -156,6 +194,16 @@ void launch_interpreter(Args... args) {
                                       args...);
   });
 }
+
+#ifdef ENCORE_HAVE_COROUTINES
+
+void launch_coroutine(coroutine::task t) {
+  launch(machine::get_nb_workers(), [&] {
+    return new coroutine::vertex_type(coroutine::run_and_report_elapsed(std::move(t)));
+  });
+}
+
+#endif
   
 } // end namespace
 
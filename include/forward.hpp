@@ -14,9 +14,8 @@ struct vertex_split_struct;
 using vertex_split_type = struct vertex_split_struct;
   
 void schedule(vertex* v);
-void parallel_notify(outset*);
+void parallel_notify(outset*, vertex* source);
 void release(vertex* v);
-void suspend(vertex* v);
   
 } // end namespace
 } // end namespace
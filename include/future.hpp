@@ -0,0 +1,255 @@
+#include <assert.h>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "fuel.hpp"
+#include "vertex.hpp"
+#include "outset.hpp"
+#include "scheduler.hpp"
+
+#ifndef _ENCORE_FUTURE_H_
+#define _ENCORE_FUTURE_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Value-carrying futures
+ *
+ * A future<Item> is a handle on a value of type Item that is computed
+ * by a vertex. The value is stored next to the chain outset of the
+ * vertex (see sched::future): once the vertex has completed, the value
+ * is set, and the successors of the vertex, which were registered by
+ * sched::new_edge, are notified.
+ *
+ *   auto f = encore::async([] { return 42; });
+ *   auto g = f.then([] (int& x) { return x + 1; });
+ *   auto h = encore::when_all(f, g).then([] (std::tuple<int, int>& t) {
+ *     ...
+ *   });
+ *
+ * None of these operations blocks: async(), then() and when_all() each
+ * create a new vertex, with one incoming edge for each future that the
+ * vertex depends on, and return a future for the value of this vertex.
+ * The value of a future may be read, by get(), only by a successor of
+ * the vertex that computes it, e.g., in the function given to then().
+ * DSL code may instead wait for a future by passing get_future() to
+ * dc::join_minus.
+ *
+ * These operations are to be called by code that runs on a worker.
+ */
+
+template <class Item>
+class future;
+
+namespace futures {
+
+template <class Item>
+class state_type {
+public:
+
+  sched::future control;
+
+  Item value;
+
+  template <class Function>
+  void compute(Function& f) {
+    value = f();
+  }
+
+};
+
+template <>
+class state_type<void> {
+public:
+
+  sched::future control;
+
+  template <class Function>
+  void compute(Function& f) {
+    f();
+  }
+
+};
+
+// a vertex that computes the value of a future by calling f, once
+template <class Item, class Function>
+class compute_vertex : public sched::vertex {
+private:
+
+  std::shared_ptr<state_type<Item>> state;
+
+  Function f;
+
+  bool completed = false;
+
+public:
+
+  compute_vertex(std::shared_ptr<state_type<Item>> state, const Function& f)
+  : state(state), f(f) { }
+
+  int nb_strands() {
+    return completed ? 0 : 1;
+  }
+
+  fuel::check_type run() {
+    state->compute(f);
+    completed = true;
+    return fuel::check_no_promote;
+  }
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+template <class Item>
+void add_edge(const future<Item>& source, sched::vertex* destination) {
+  sched::future& control = source.state->control;
+  if (control) {
+    sched::new_edge(control, destination);
+  }
+}
+
+static inline
+void add_edges(sched::vertex*) { }
+
+template <class Item, class ...Items>
+void add_edges(sched::vertex* destination, const future<Item>& source, const future<Items>&... sources) {
+  add_edge(source, destination);
+  add_edges(destination, sources...);
+}
+
+// returns the future of a new vertex that calls f once all of the
+// futures in sources are set
+template <class Function, class ...Items>
+auto spawn(const Function& f, const future<Items>&... sources) -> future<decltype(f())> {
+  using item_type = decltype(f());
+  auto state = std::make_shared<state_type<item_type>>();
+  auto v = new compute_vertex<item_type, Function>(state, f);
+  state->control = v->get_outset()->make_chain_future();
+  add_edges(v, sources...);
+  sched::release(v);
+  return future<item_type>(state);
+}
+
+template <class Function, class Item>
+auto call_with(const Function& f, state_type<Item>& s) -> decltype(f(s.value)) {
+  return f(s.value);
+}
+
+template <class Function>
+auto call_with(const Function& f, state_type<void>&) -> decltype(f()) {
+  return f();
+}
+
+} // end namespace
+
+template <class Item>
+class future {
+public:
+
+  using value_type = Item;
+
+  std::shared_ptr<futures::state_type<Item>> state;
+
+  future() { }
+
+  explicit future(std::shared_ptr<futures::state_type<Item>> state)
+  : state(state) { }
+
+  // returns true if this future refers to a value
+  bool valid() const {
+    return (bool)state;
+  }
+
+  // to be called only by a successor of the vertex that sets the value
+  typename std::add_lvalue_reference<Item>::type get() const {
+    assert(valid());
+    return state->value;
+  }
+
+  // the control dependency, for use with dc::join_minus; it is null for
+  // a future made by make_ready_future, which has no vertex, in which
+  // case join_minus does not wait, but sched::new_edge is not to be
+  // given it
+  sched::future* get_future() const {
+    assert(valid());
+    return &state->control;
+  }
+
+  // returns the future of the value of f(get()), or of f() for a future
+  // of void, which is computed by a new vertex once this future is set
+  template <class Function>
+  auto then(const Function& f) const
+  -> future<decltype(futures::call_with(f, std::declval<futures::state_type<Item>&>()))> {
+    assert(valid());
+    auto s = state;
+    return futures::spawn([s, f] {
+      return futures::call_with(f, *s);
+    }, *this);
+  }
+
+};
+
+template <>
+inline
+void future<void>::get() const {
+  assert(valid());
+}
+
+// returns a future that is already set to x, and whose control
+// dependency is null
+template <class Item>
+future<typename std::decay<Item>::type> make_ready_future(Item&& x) {
+  using item_type = typename std::decay<Item>::type;
+  auto state = std::make_shared<futures::state_type<item_type>>();
+  state->value = std::forward<Item>(x);
+  return future<item_type>(state);
+}
+
+// returns the future of the value of f(), which is computed by a new
+// vertex
+template <class Function>
+auto async(const Function& f) -> future<decltype(f())> {
+  return futures::spawn(f);
+}
+
+// returns the future of the tuple of the values of fs, which is set
+// once all of fs are set
+template <class ...Items>
+future<std::tuple<Items...>> when_all(const future<Items>&... fs) {
+  return futures::spawn([=] {
+    return std::make_tuple(fs.get()...);
+  }, fs...);
+}
+
+// returns the future of the vector of the values of fs, which is set
+// once all of fs are set
+template <class Item>
+future<std::vector<Item>> when_all(const std::vector<future<Item>>& fs) {
+  auto state = std::make_shared<futures::state_type<std::vector<Item>>>();
+  auto f = [=] {
+    std::vector<Item> items;
+    items.reserve(fs.size());
+    for (auto& x : fs) {
+      items.push_back(x.get());
+    }
+    return items;
+  };
+  auto v = new futures::compute_vertex<std::vector<Item>, decltype(f)>(state, f);
+  state->control = v->get_outset()->make_chain_future();
+  for (auto& x : fs) {
+    futures::add_edge(x, v);
+  }
+  sched::release(v);
+  return future<std::vector<Item>>(state);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_FUTURE_H_ */
@@ -0,0 +1,243 @@
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#ifdef TARGET_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _ENCORE_HWCOUNTERS_H_
+#define _ENCORE_HWCOUNTERS_H_
+
+namespace encore {
+namespace hwcounters {
+
+/*---------------------------------------------------------------------*/
+/* Hardware performance counters
+ *
+ * A counter group is opened, via perf_event_open, by the thread whose
+ * events are to be counted, and counts only the user-level events of
+ * that thread. Events that are not supported by the machine (e.g., in
+ * a virtual machine) are left out of the group and read as zero.
+ *
+ * When the group shares the hardware counters with other groups (e.g.,
+ * with a sibling hyperthread, or with the NMI watchdog), the kernel
+ * multiplexes them, so that the group counts only part of the time.
+ * Reads then scale the counts by the ratio of the time during which the
+ * group was enabled to the time during which it was counting.
+ */
+
+using counter_id_type = enum {
+  cycles,
+  instructions,
+  llc_misses,
+  dtlb_misses,
+  branch_misses,
+  nb_counters
+};
+
+static
+const char* name_of(counter_id_type id) {
+  switch (id) {
+    case cycles: return "cycles";
+    case instructions: return "instructions";
+    case llc_misses: return "llc_misses";
+    case dtlb_misses: return "dtlb_misses";
+    case branch_misses: return "branch_misses";
+    default: return "unknown";
+  }
+}
+
+using snapshot_type = struct {
+  uint64_t values[nb_counters];
+};
+
+static inline
+void clear(snapshot_type& s) {
+  for (int i = 0; i < nb_counters; i++) {
+    s.values[i] = 0;
+  }
+}
+
+// dst += (finish - start); scaled counts may go backwards by a little,
+// which counts as zero
+static inline
+void accumulate(snapshot_type& dst, const snapshot_type& start, const snapshot_type& finish) {
+  for (int i = 0; i < nb_counters; i++) {
+    if (finish.values[i] > start.values[i]) {
+      dst.values[i] += finish.values[i] - start.values[i];
+    }
+  }
+}
+
+class group_type {
+private:
+
+  int leader_fd = -1;
+
+  int fds[nb_counters];
+
+  // position of each counter in the buffer returned by a group read, or -1
+  int position_of[nb_counters];
+
+  int nb_opened = 0;
+
+  // the times, in nanoseconds, that the last read reported
+  uint64_t time_enabled = 0;
+  uint64_t time_running = 0;
+
+#ifdef TARGET_LINUX
+  static
+  long perf_event_open(struct perf_event_attr* attr, pid_t pid,
+                       int cpu, int group_fd, unsigned long flags) {
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+  }
+
+  static
+  void attributes_of(counter_id_type id, struct perf_event_attr& attr) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP
+                     | PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (id) {
+      case cycles: {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      }
+      case instructions: {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      }
+      case llc_misses: {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      }
+      case dtlb_misses: {
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      }
+      case branch_misses: {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+  }
+#endif
+
+public:
+
+  group_type() {
+    for (int i = 0; i < nb_counters; i++) {
+      fds[i] = -1;
+      position_of[i] = -1;
+    }
+  }
+
+  // to be called by the thread to be measured; returns false if the
+  // group could not be opened (e.g., because of perf_event_paranoid)
+  bool open() {
+    close();
+#ifdef TARGET_LINUX
+    for (int i = 0; i < nb_counters; i++) {
+      struct perf_event_attr attr;
+      attributes_of((counter_id_type)i, attr);
+      attr.disabled = (leader_fd == -1) ? 1 : 0;
+      int fd = (int)perf_event_open(&attr, 0, -1, leader_fd, 0);
+      if (fd == -1) {
+        if (i == cycles) {
+          return false;
+        }
+        continue;
+      }
+      if (leader_fd == -1) {
+        leader_fd = fd;
+      }
+      fds[i] = fd;
+      position_of[i] = nb_opened++;
+    }
+    ioctl(leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool is_open() const {
+    return leader_fd != -1;
+  }
+
+  // the counts are scaled up if the group was multiplexed, and read as
+  // zero if the group never counted
+  void read(snapshot_type& s) {
+    clear(s);
+#ifdef TARGET_LINUX
+    if (! is_open()) {
+      return;
+    }
+    // the number of counters, the times enabled and running, and the counts
+    uint64_t buf[3 + nb_counters];
+    ssize_t n = ::read(leader_fd, buf, sizeof(buf));
+    if (n < (ssize_t)(3 * sizeof(uint64_t))) {
+      return;
+    }
+    time_enabled = buf[1];
+    time_running = buf[2];
+    if (time_running == 0) {
+      return;
+    }
+    double scale = (double)time_enabled / (double)time_running;
+    for (int i = 0; i < nb_counters; i++) {
+      int p = position_of[i];
+      if ((p != -1) && (p < buf[0])) {
+        uint64_t v = buf[3 + p];
+        s.values[i] = (time_enabled == time_running) ? v : (uint64_t)(v * scale);
+      }
+    }
+#endif
+  }
+
+  // returns true if, as of the last read, the group was enabled but
+  // never counted, e.g., because all hardware counters were taken
+  bool was_never_scheduled() const {
+    return (time_enabled > 0) && (time_running == 0);
+  }
+
+  void close() {
+#ifdef TARGET_LINUX
+    for (int i = 0; i < nb_counters; i++) {
+      if (fds[i] != -1) {
+        ::close(fds[i]);
+      }
+      fds[i] = -1;
+      position_of[i] = -1;
+    }
+#endif
+    leader_fd = -1;
+    nb_opened = 0;
+    time_enabled = 0;
+    time_running = 0;
+  }
+
+};
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_HWCOUNTERS_H_ */
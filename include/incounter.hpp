@@ -337,6 +337,17 @@ public:
       schedule(v);
     }
   }
+  
+  vertex* get_vertex() const {
+    assert(h != nullptr);
+    incounter_tag_type tag = static_cast<incounter_tag_type>(tagged::tag_of(h));
+    if (tag == incounter_tag_fetch_add) {
+      return tagged::value_of<fetch_add_cell_type*, void*>(h)->v;
+    } else {
+      auto n = tagged::value_of<gsnzi_tree_node_type*, void*>(h);
+      return gsnzi_tree_node_type::get_root_annotation<vertex*>(n);
+    }
+  }
 
 };
 
@@ -13,6 +13,7 @@
 #include "scheduler.hpp"
 #include "pcfg.hpp"
 #include "grain.hpp"
+#include "blockprofile.hpp"
 
 #ifndef _ENCORE_INTERPRETER_H_
 #define _ENCORE_INTERPRETER_H_
@@ -44,6 +45,15 @@ public:
 };
 
 using vertex_split_type = sched::vertex_split_type;
+
+/* The mark stack of a cactus stack links the frames that are
+ * splittable. Pushing and popping frames maintains it, and so does
+ * the interpreter, after any step that changes whether the newest
+ * frame is splittable. A step that does so in a way that the
+ * interpreter does not handle on the spot sets the flag below, so
+ * that the next interpreter::run rebuilds the mark stack.
+ */
+data::perworker::array<bool> stale_mark_stack;
   
 sched::vertex* dummy_join = nullptr;
   
@@ -453,45 +463,49 @@ public:
   fuel::check_type run() {
     fuel::check_type f = fuel::check_no_promote;
     {
+      bool& stale = stale_mark_stack.mine();
+      stale = false;
       stack_type s = stack;
       while ((! empty_stack(s)) && (f == fuel::check_no_promote)) {
         auto r = peek_newest_shared_frame<shared_activation_record>(s).run(s);
         s = r.first;
         f = r.second;
       }
-      stack = cactus::update_mark_stack(s, [&] (char* _ar) {
-        return pcfg::is_splittable(_ar);
-      });
+      if (stale) {
+        s = cactus::update_mark_stack(s, [&] (char* _ar) {
+          return pcfg::is_splittable(_ar);
+        });
+      }
+      stack = s;
     }
 #ifdef DEBUG_ENCORE_STACK
     check_stack(stack);
 #endif
     if (nb_strands() == 0) {
-      assert(! is_suspended);
+      assert(! is_waiting);
       assert(f != fuel::check_suspend);
       return fuel::check_no_promote;
     }
     if (f == fuel::check_suspend) {
-      is_suspended = true;
+      // the marks are promoted first, and then the vertex that holds
+      // the join_minus waits for its future, by wait()
+      is_waiting = true;
       f = fuel::check_yes_promote;
     }
     if (f == fuel::check_no_promote) {
       return f;
     }
     if (never_promote) {
-      schedule(this);
+      if (! is_waiting) {
+        schedule(this);
+      }
       return fuel::check_no_promote;
     }
     assert(f == fuel::check_yes_promote);
     auto r = peek_mark(stack);
     switch (r.tag) {
       case Peek_mark_none: {
-        if (is_suspended) {
-          is_suspended = false;
-          auto& par = peek_newest_shared_frame<shared_activation_record>(stack);
-          auto dep = par.get_dependency_of_join_minus(stack);
-          sched::new_edge(dep, this);
-        } else {
+        if (! is_waiting) {
           schedule(this);
         }
         break;
@@ -503,7 +517,9 @@ public:
       case Peek_mark_loop_split: {
         auto r = split(nb_strands() / 2);
         schedule(r.v2);
-        schedule(r.v1);
+        if ((r.v1 != this) || (! is_waiting)) {
+          schedule(r.v1);
+        }
         if (r.v0 != nullptr) {
           schedule(r.v0);
         }
@@ -522,6 +538,27 @@ public:
     return peek_marked_private_frame<private_activation_record>(stack).split(this, nb);
   }
   
+  // the newest frame is at a join_minus whose future is not set yet:
+  // the future schedules the vertex once it is set
+  bool wait() {
+    auto& sar = peek_newest_shared_frame<shared_activation_record>(stack);
+    auto dep = sar.get_dependency_of_join_minus(stack);
+    sched::new_edge(dep, this);
+    return true;
+  }
+  
+  // to be called by a promotion that moves the newest frames of this
+  // vertex to v, before v is released or scheduled: if this vertex is
+  // to wait, v waits instead
+  void hand_over_wait(interpreter* v) {
+    if (! is_waiting) {
+      return;
+    }
+    is_waiting = false;
+    stats::on_wait();
+    v->wait();
+  }
+  
 };
 
 template <class Shared_activation_record>
@@ -543,6 +580,7 @@ std::pair<stack_type, fuel::check_type> step(cfg_type<Shared_activation_record>&
   auto start_time = cycles::now();
   assert(pred >= 0 && pred < cfg.nb_basic_blocks());
   bool possibly_updated_parallel_loop_range = false;
+  bool was_splittable = (par.nb_strands() >= 2);
   auto& block = cfg.basic_blocks[pred];
   switch (block.tag) {
     case tag_unconditional_jump: {
@@ -607,16 +645,26 @@ std::pair<stack_type, fuel::check_type> step(cfg_type<Shared_activation_record>&
   f = (f == fuel::check_suspend) ? f : fuel::check(end_time);
   auto elapsed = cycles::diff(start_time, end_time);
   grain::callback(elapsed);
-  if (possibly_updated_parallel_loop_range) {
-    stack = cactus::update_mark_stack_just_for_loops(stack, [&] (char* _ar) {
-              return pcfg::is_splittable(_ar);
-            });
-#ifdef DEBUG_ENCORE_STACK
-    check_stack(stack);
+#ifdef ENCORE_ENABLE_PROFILING
+  profile::on_block(sched::my_vertex()->span, elapsed);
+  block_profile::on_block(&cfg, sar, cfg.nb_basic_blocks(), pred, block.tag, succ, elapsed);
 #endif
+  if (block.tag == tag_tail) {
+    // the frame of par was replaced by that of the callee
+    stale_mark_stack.mine() = true;
+  } else if ((par.nb_strands() >= 2) != was_splittable) {
+    if (possibly_updated_parallel_loop_range) {
+      stack = cactus::update_mark_stack_just_for_loops(stack, [&] (char* _ar) {
+                return pcfg::is_splittable(_ar);
+              });
+    } else {
+      stale_mark_stack.mine() = true;
+    }
   }
 #ifdef DEBUG_ENCORE_STACK
-  check_stack(stack);
+  if (! stale_mark_stack.mine()) {
+    check_stack(stack);
+  }
 #endif
   return std::make_pair(stack, f);
 }
@@ -627,6 +675,7 @@ void promote_mark(cfg_type<Shared_activation_record>& cfg, interpreter* interp,
   basic_block_label_type pred = par->trampoline.pred;
   assert(pred != exit_block_label);
   assert(pred >= 0 && pred < cfg.nb_basic_blocks());
+  block_profile::on_promotion(&cfg, *sar, cfg.nb_basic_blocks(), pred);
   auto& block = cfg.basic_blocks[pred];
   switch (block.tag) {
     case tag_spawn2_join: {
@@ -636,9 +685,14 @@ void promote_mark(cfg_type<Shared_activation_record>& cfg, interpreter* interp,
       });
       join->stack = stacks.first;
       interpreter* branch1 = new interpreter(stacks.second);
+      join->hand_over_wait(branch1);
       interpreter* branch2 = new interpreter;
       branch1->get_outset()->make_unary();
       branch2->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(join->span, branch1->span);
+      profile::on_promotion(join->span, branch2->span);
+#endif
       basic_block_label_type pred = par->trampoline.succ;
       auto& spawn_join_block = cfg.basic_blocks[pred];
       assert(spawn_join_block.tag == tag_spawn_join);
@@ -663,7 +717,11 @@ void promote_mark(cfg_type<Shared_activation_record>& cfg, interpreter* interp,
       });
       continuation->stack = stacks.first;
       interpreter* branch = new interpreter(stacks.second);
+      continuation->hand_over_wait(branch);
       branch->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(continuation->span, branch->span);
+#endif
       sched::incounter* incounter = *block.variant_spawn_minus.getter(*sar, *par);
       assert(incounter != nullptr);
       sched::new_edge(branch, incounter);
@@ -679,6 +737,10 @@ void promote_mark(cfg_type<Shared_activation_record>& cfg, interpreter* interp,
       });
       continuation->stack = stacks.first;
       interpreter* branch = new interpreter(stacks.second);
+      continuation->hand_over_wait(branch);
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(continuation->span, branch->span);
+#endif
       auto branch_out = branch->get_outset();
       auto future = branch_out->make_chain_future();
       assert(! *block.variant_spawn_plus.getter(*sar, *par));
@@ -695,6 +757,10 @@ void promote_mark(cfg_type<Shared_activation_record>& cfg, interpreter* interp,
       });
       continuation->stack = stacks.first;
       interpreter* branch = new interpreter(stacks.second);
+      continuation->hand_over_wait(branch);
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(continuation->span, branch->span);
+#endif
       assert(*block.variant_join_plus.getter(*sar, *par) == nullptr);
       *block.variant_join_plus.getter(*sar, *par) = continuation->get_incounter();
       sched::new_edge(branch, continuation);
@@ -825,12 +891,18 @@ public:
       interp0->stack = stacks.first;
       interpreter* interp01 = new interpreter(create_stack(sar0, par0));
       interp01->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(interp0->span, interp01->span);
+#endif
       par_type* par01 = &peek_newest_private_frame<par_type>(interp01->stack);
       par01->initialize_descriptors();
       auto lpar01 = par01->loop_activation_record_of(id);
       lpar0->split(lpar01, lpar0->nb_strands());
       interp1 = new interpreter(create_stack(sar0, par01));
       interp1->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+      profile::on_promotion(interp0->span, interp1->span);
+#endif
       par1 = &peek_newest_private_frame<par_type>(interp1->stack);
       par1->initialize_descriptors();
       auto lpar1 = par1->loop_activation_record_of(id);
@@ -842,7 +914,6 @@ public:
         return pcfg::is_splittable(_ar);
       });
       nb--;
-      std::swap(interp0->is_suspended, interp01->is_suspended);
       par0->trampoline = lpdescr.exit;
       par1->trampoline = lpdescr.entry;
       lpar1->get_join() = join;
@@ -858,16 +929,28 @@ public:
       } else {
         interp00 = new interpreter(stacks.second);
         interp00->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+        profile::on_promotion(interp0->span, interp00->span);
+#endif
         sched::new_edge(interp00, interp01);
         release(interp01);
       }
       interp00->make_ready();
       interp1->make_ready();
+      if (interp0->is_waiting) {
+        // interp00 holds the newest frames, so it waits, rather than
+        // being scheduled with the others
+        interp0->hand_over_wait(interp00);
+        interp00 = nullptr;
+      }
     } else {
       interp1 = interp0;
     }
     interp2 = new interpreter(create_stack(sar0, par1));
     interp2->get_outset()->make_unary();
+#ifdef ENCORE_ENABLE_PROFILING
+    profile::on_promotion(interp0->span, interp2->span);
+#endif
     par_type* par2 = &peek_newest_private_frame<par_type>(interp2->stack);
     par2->initialize_descriptors();
     auto lpar2 = par2->loop_activation_record_of(id);
@@ -899,6 +982,9 @@ public:
     sar_type* sar1 = sar0;
     auto lpar1 = par1->loop_activation_record_of(id);
     interp2 = new interpreter(create_stack(sar1, par1));
+#ifdef ENCORE_ENABLE_PROFILING
+    profile::on_promotion(interp1->span, interp2->span);
+#endif
     auto interp2_out = interp2->get_outset();
     auto interp2_future = interp2_out->make_chain_future();
     par_type* par2 = &peek_newest_private_frame<par_type>(interp2->stack);
@@ -933,6 +1019,7 @@ public:
     par_type* par0 = &peek_marked_private_frame<par_type>(interp0->stack);
     sar_type* sar0 = &peek_marked_shared_frame<sar_type>(interp0->stack);
     parallel_loop_id_type id = par0->get_id_of_oldest_nonempty();
+    block_profile::on_promotion(&sar_type::cfg, *sar0, sar_type::cfg.nb_basic_blocks(), par0->trampoline.pred);
     switch (sar_type::cfg.loop_descriptors[id].join) {
       case parallel_loop_descriptor_type<par_type>::join_trivial: {
         result = split_join_trivial(interp0, par0, sar0, id, nb);
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <sys/types.h>
+
+#include "fuel.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+#include "iouring.hpp"
+#include "future.hpp"
+
+#ifndef _ENCORE_IO_H_
+#define _ENCORE_IO_H_
+
+namespace encore {
+namespace io {
+
+/*---------------------------------------------------------------------*/
+/* Asynchronous file I/O
+ *
+ * read() and write() submit a request to the io_uring of the runtime
+ * (see iouring.hpp), and return a future for its result: the number of
+ * bytes transferred, or minus an errno value. The future is set by a
+ * vertex that is released by the worker that reaps the completion, so
+ * that no worker blocks, or retries the vertex, while the request is in
+ * flight. For example, DSL code reads a block of a file, and then
+ * parses it in parallel, by:
+ *
+ *   dc::stmt([] (sar& s, par&) {
+ *     s.r = io::read(s.fd, s.buf, s.nbytes, s.offset);
+ *   }),
+ *   dc::join_minus([] (sar& s, par&) {
+ *     return s.r.get_future();
+ *   }),
+ *   dc::spawn_join([] (sar& s, par&, plt p, stt st) {
+ *     return parse(st, p, s.buf, s.r.get());
+ *   })
+ *
+ * The buffer is to remain valid until the future is set. These
+ * functions are to be called by code that runs on a worker.
+ */
+
+class request_vertex : public sched::vertex {
+public:
+
+  request_type request;
+
+  std::shared_ptr<futures::state_type<ssize_t>> state;
+
+  bool completed = false;
+
+  request_vertex(opcode_type opcode, int fd, void* buf, std::size_t nbytes, off_t offset)
+  : state(std::make_shared<futures::state_type<ssize_t>>()) {
+    request.opcode = opcode;
+    request.fd = fd;
+    request.buf = buf;
+    request.nbytes = (unsigned)nbytes;
+    request.offset = (uint64_t)offset;
+    request.waiter = this;
+    state->control = get_outset()->make_chain_future();
+  }
+
+  int nb_strands() {
+    return completed ? 0 : 1;
+  }
+
+  // runs once the request has completed
+  fuel::check_type run() {
+    state->value = (ssize_t)request.result;
+    completed = true;
+    return fuel::check_no_promote;
+  }
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+// the length of a request is an unsigned, and Linux transfers less
+// than 2 GiB per read or write anyway
+static constexpr std::size_t max_request_szb = 1 << 30;
+
+static inline
+future<ssize_t> start_request(opcode_type opcode, int fd, void* buf, std::size_t nbytes, off_t offset) {
+  assert(nbytes <= max_request_szb);
+  auto v = new request_vertex(opcode, fd, buf, nbytes, offset);
+  future<ssize_t> r(v->state);
+  // the completion of the request releases v
+  submit(&v->request);
+  return r;
+}
+
+// larger transfers are split into requests of max_request_szb bytes
+// at most, whose results are then combined as one short transfer: the
+// bytes up to the first request that is short, or that fails
+static inline
+future<ssize_t> start(opcode_type opcode, int fd, void* buf, std::size_t nbytes, off_t offset) {
+  if (nbytes <= max_request_szb) {
+    return start_request(opcode, fd, buf, nbytes, offset);
+  }
+  std::vector<future<ssize_t>> rs;
+  std::vector<std::size_t> szbs;
+  for (std::size_t i = 0; i < nbytes; i += max_request_szb) {
+    auto szb = std::min(max_request_szb, nbytes - i);
+    rs.push_back(start_request(opcode, fd, (char*)buf + i, szb, offset + (off_t)i));
+    szbs.push_back(szb);
+  }
+  return when_all(rs).then([szbs] (std::vector<ssize_t>& ns) {
+    ssize_t total = 0;
+    for (std::size_t i = 0; i < ns.size(); i++) {
+      if (ns[i] < 0) {
+        return (total > 0) ? total : ns[i];
+      }
+      total += ns[i];
+      if ((std::size_t)ns[i] < szbs[i]) {
+        break;
+      }
+    }
+    return total;
+  });
+}
+
+// reads at most nbytes bytes at offset offset of file fd into buf
+static inline
+future<ssize_t> read(int fd, void* buf, std::size_t nbytes, off_t offset) {
+  return start(opcode_read, fd, buf, nbytes, offset);
+}
+
+// writes nbytes bytes of buf at offset offset of file fd
+static inline
+future<ssize_t> write(int fd, const void* buf, std::size_t nbytes, off_t offset) {
+  return start(opcode_write, fd, const_cast<void*>(buf), nbytes, offset);
+}
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_IO_H_ */
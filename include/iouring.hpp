@@ -0,0 +1,370 @@
+#include <assert.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifdef TARGET_LINUX
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define ENCORE_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include "forward.hpp"
+#include "perworker.hpp"
+#include "cmdline.hpp"
+
+#ifndef _ENCORE_IOURING_H_
+#define _ENCORE_IOURING_H_
+
+namespace encore {
+namespace io {
+
+/*---------------------------------------------------------------------*/
+/* Asynchronous I/O requests
+ *
+ * A request is a read or a write of a file at a given offset, which is
+ * submitted to an io_uring that is shared by all of the workers. Each
+ * request has a waiter, i.e., a vertex that holds its release handle:
+ * once the request completes, its result (the number of bytes
+ * transferred, or minus an errno value) is set, and the waiter is
+ * released, and thereby scheduled, by the worker that reaps the
+ * completion. The workers reap completions in their scheduler loops,
+ * by poll(); a worker that has requests in flight keeps polling, rather
+ * than stealing, when it runs out of work.
+ *
+ * When io_uring is not available (or cannot be set up, e.g., because
+ * it is disabled by the system, or because the kernel predates reads
+ * and writes on rings), requests are performed synchronously by
+ * submit(). A request that the ring fails with -EINVAL is performed
+ * again, synchronously, by pread or pwrite.
+ *
+ * The vertex-level interface is in io.hpp.
+ */
+
+using opcode_type = enum {
+  opcode_read,
+  opcode_write
+};
+
+class request_type {
+public:
+  opcode_type opcode;
+  int fd;
+  void* buf;
+  unsigned nbytes;
+  uint64_t offset;
+  // to be released once the request completes
+  sched::vertex* waiter;
+  long result = 0;
+  // the worker that submitted the request
+  int worker = -1;
+};
+
+unsigned ring_entries = 256;
+
+// number of requests submitted by each worker that are not completed
+data::perworker::array<std::atomic<int>> nb_pending;
+
+void initialize() {
+  int n = deepsea::cmdline::parse_or_default_int("io_ring_entries", (int)ring_entries);
+  ring_entries = (unsigned)std::max(1, n);
+}
+
+static inline
+void complete(request_type* r, long result) {
+  r->result = result;
+  nb_pending[r->worker]--;
+  sched::release(r->waiter);
+}
+
+void perform_synchronously(request_type* r) {
+  long n = -ENOSYS;
+#ifdef TARGET_LINUX
+  if (r->opcode == opcode_read) {
+    n = pread(r->fd, r->buf, r->nbytes, (off_t)r->offset);
+  } else {
+    n = pwrite(r->fd, r->buf, r->nbytes, (off_t)r->offset);
+  }
+  if (n < 0) {
+    n = -errno;
+  }
+#endif
+  complete(r, n);
+}
+
+#ifdef ENCORE_HAVE_IO_URING
+
+class ring_type {
+private:
+
+  int fd = -1;
+
+  char* sq = nullptr;
+  std::size_t sq_szb = 0;
+  char* cq = nullptr;
+  std::size_t cq_szb = 0;
+  std::size_t sqes_szb = 0;
+
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes = nullptr;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // returns nullptr on failure
+  char* map(std::size_t szb, off_t offset) {
+    void* p = mmap(nullptr, szb, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return (p == MAP_FAILED) ? nullptr : (char*)p;
+  }
+
+  // the probe itself appeared in Linux 5.6, along with IORING_OP_READ
+  // and IORING_OP_WRITE
+  bool supports_read_write() {
+    static constexpr unsigned nb_ops = 256;
+    std::vector<char> buf(sizeof(struct io_uring_probe) + nb_ops * sizeof(struct io_uring_probe_op), 0);
+    auto probe = (struct io_uring_probe*)buf.data();
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nb_ops) < 0) {
+      return false;
+    }
+    auto supports = [&] (unsigned op) {
+      return (op <= probe->last_op) && ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0);
+    };
+    return supports(IORING_OP_READ) && supports(IORING_OP_WRITE);
+  }
+
+public:
+
+  unsigned nb_entries = 0;
+
+  // returns false if the ring could not be set up, or if the kernel
+  // does not support reads and writes on rings (before Linux 5.6)
+  bool initialize(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+      return false;
+    }
+    sq_szb = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_szb = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_szb = cq_szb = std::max(sq_szb, cq_szb);
+    }
+    sq = map(sq_szb, IORING_OFF_SQ_RING);
+    if (sq == nullptr) {
+      teardown();
+      return false;
+    }
+    if (single_mmap) {
+      cq = sq;
+    } else {
+      cq = map(cq_szb, IORING_OFF_CQ_RING);
+      if (cq == nullptr) {
+        teardown();
+        return false;
+      }
+    }
+    sqes_szb = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)map(sqes_szb, IORING_OFF_SQES);
+    if ((sqes == nullptr) || (! supports_read_write())) {
+      teardown();
+      return false;
+    }
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    nb_entries = p.sq_entries;
+    return true;
+  }
+
+  // unmaps the rings and closes the ring, if they are set up
+  void teardown() {
+    if (sqes != nullptr) {
+      munmap(sqes, sqes_szb);
+      sqes = nullptr;
+    }
+    if ((cq != nullptr) && (cq != sq)) {
+      munmap(cq, cq_szb);
+    }
+    cq = nullptr;
+    if (sq != nullptr) {
+      munmap(sq, sq_szb);
+      sq = nullptr;
+    }
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    nb_entries = 0;
+  }
+
+  ~ring_type() {
+    teardown();
+  }
+
+  // to be called by one thread at a time; returns false if the kernel
+  // rejected the request
+  bool submit(request_type* r) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (r->opcode == opcode_read) ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)r->buf;
+    sqe->len = r->nbytes;
+    sqe->off = r->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)r;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    int n = (int)syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+    if (n == 1) {
+      return true;
+    }
+    // take the entry back
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  // to be called by one thread at a time; moves the completed requests
+  // to completed
+  void reap(std::vector<std::pair<request_type*, long>>& completed) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+      completed.push_back(std::make_pair((request_type*)(uintptr_t)cqe->user_data, (long)cqe->res));
+      head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+
+};
+
+ring_type ring;
+
+std::once_flag ring_once;
+
+bool ring_enabled = false;
+
+std::mutex ring_mutex;
+
+// requests in the ring
+std::atomic<unsigned> nb_in_flight(0);
+
+// requests that are waiting for room in the ring
+std::deque<request_type*> overflow;
+
+// to be called with ring_mutex held; returns false if the kernel
+// rejected r, which is then to be performed synchronously, once the
+// lock is released
+bool submit_to_ring(request_type* r) {
+  if (nb_in_flight.load() >= ring.nb_entries) {
+    overflow.push_back(r);
+    return true;
+  }
+  nb_in_flight++;
+  if (! ring.submit(r)) {
+    nb_in_flight--;
+    return false;
+  }
+  return true;
+}
+
+#endif
+
+// r->waiter is to hold its release handle until the request completes
+void submit(request_type* r) {
+  r->worker = data::perworker::get_my_id();
+  nb_pending[r->worker]++;
+#ifdef ENCORE_HAVE_IO_URING
+  std::call_once(ring_once, [] {
+    ring_enabled = ring.initialize(ring_entries);
+  });
+  if (ring_enabled) {
+    bool submitted;
+    {
+      std::lock_guard<std::mutex> lock(ring_mutex);
+      submitted = submit_to_ring(r);
+    }
+    if (! submitted) {
+      perform_synchronously(r);
+    }
+    return;
+  }
+#endif
+  perform_synchronously(r);
+}
+
+// returns true if requests submitted by the calling worker are pending
+static inline
+bool has_pending() {
+  return nb_pending.mine().load() > 0;
+}
+
+// reaps the completed requests, if any, and releases their waiters
+static inline
+void poll() {
+#ifdef ENCORE_HAVE_IO_URING
+  if (nb_in_flight.load() == 0) {
+    return;
+  }
+  std::vector<std::pair<request_type*, long>> completed;
+  std::vector<request_type*> rejected;
+  {
+    std::unique_lock<std::mutex> lock(ring_mutex, std::try_to_lock);
+    if (! lock.owns_lock()) {
+      return;
+    }
+    ring.reap(completed);
+    nb_in_flight -= (unsigned)completed.size();
+    while ((! overflow.empty()) && (nb_in_flight.load() < ring.nb_entries)) {
+      request_type* r = overflow.front();
+      overflow.pop_front();
+      if (! submit_to_ring(r)) {
+        rejected.push_back(r);
+      }
+    }
+  }
+  // the blocking fallbacks, and the releases of the waiters, run
+  // without the lock that every worker takes to submit, or to reap
+  for (auto r : rejected) {
+    perform_synchronously(r);
+  }
+  for (auto& c : completed) {
+    if (c.second == -EINVAL) {
+      // the kernel may reject the opcode, even if the probe did not
+      // tell; a request that fails for other reasons fails again
+      perform_synchronously(c.first);
+    } else {
+      complete(c.first, c.second);
+    }
+  }
+#endif
+}
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_IOURING_H_ */
@@ -1,11 +1,13 @@
-#include <chrono>
 #include <vector>
 #include <string>
 #include <cstdlib>
 #include <cstdio>
 #include <algorithm>
 #include <memory>
+#include <queue>
+#include <functional>
 
+#include "cycles.hpp"
 #include "machine.hpp"
 #include "perworker.hpp"
 #include "cmdline.hpp"
@@ -127,7 +129,8 @@ program_point_type dflt_ppt = { .line_nb = -1, .source_fname = nullptr, .ptr = n
 class event_type {
 public:
   
-  double timestamp;
+  // in cycles, as returned by cycles::now()
+  uint64_t timestamp;
   
   event_tag_type tag;
   
@@ -153,14 +156,22 @@ public:
     } promotion;
   } extra;
       
-  void print_byte(FILE* f) {
-    fwrite_int64 (f, (int64_t) timestamp);
+  // microseconds elapsed between basetime (in cycles) and the event
+  double timestamp_usec(uint64_t basetime) const {
+    if (timestamp < basetime) {
+      return -machine::microseconds_of_cycles(basetime - timestamp);
+    }
+    return machine::microseconds_of_cycles(timestamp - basetime);
+  }
+      
+  void print_byte(FILE* f, uint64_t basetime) {
+    fwrite_int64 (f, (int64_t) timestamp_usec(basetime));
     fwrite_int64 (f, worker_id);
     fwrite_int64 (f, tag);
   }
       
-  void print_text(FILE* f) {
-    fprintf(f, "%lf\t%d\t%s\t", timestamp, worker_id, name_of(tag).c_str());
+  void print_text(FILE* f, uint64_t basetime) {
+    fprintf(f, "%lf\t%d\t%s\t", timestamp_usec(basetime), worker_id, name_of(tag).c_str());
     switch (tag) {
       case frontier_acquire: {
         fprintf(f, "%d", extra.n1);
@@ -171,9 +182,7 @@ public:
         break;
       }
       case leaf_loop_update: {
-        double cycles_per_nsec = machine::cpu_frequency_ghz;
-        double cycles_per_usec = cycles_per_nsec * 1000;
-        double elapsed = extra.leaf_loop.elapsed / cycles_per_usec;
+        double elapsed = machine::microseconds_of_cycles(extra.leaf_loop.elapsed);
         fprintf(f, "%d \t %d \t %.3lf \t %p",
                 extra.leaf_loop.nb_iters,
                 extra.leaf_loop.nb_iters_new,
@@ -208,11 +217,334 @@ public:
 };
   
 /*---------------------------------------------------------------------*/
-/* Log buffer */
+/* Log buffer
+ *
+ * Each worker records its events in a fixed-capacity buffer. When the
+ * buffer is full, the policy selected by -log_buffer_policy applies:
+ * either "flush", which appends the contents of the buffer to a
+ * temporary file that is private to the worker, or "overwrite", which
+ * keeps only the most recent events. Because each worker pushes its
+ * events in the order of their timestamps, the stream of each worker
+ * is ordered, and the global log is obtained at exit by a k-way merge
+ * of the streams.
+ */
+
+class event_ring_type {
+private:
+  
+  size_t capacity = 0;
+  
+  bool overwrite = false;
+  
+  std::vector<event_type> items;
+  
+  // number of events pushed to items since the last flush
+  uint64_t head = 0;
+  
+  FILE* spill = nullptr;
+  
+  void flush() {
+    if (spill == nullptr) {
+      spill = tmpfile();
+      if (spill == nullptr) {
+        atomic::die("failed to create log spill file\n");
+      }
+    }
+    fwrite(items.data(), sizeof(event_type), head, spill);
+    head = 0;
+  }
+  
+public:
+  
+  ~event_ring_type() {
+    if (spill != nullptr) {
+      fclose(spill);
+    }
+  }
+  
+  void reset(size_t _capacity, bool _overwrite) {
+    capacity = std::max((size_t)1, _capacity);
+    overwrite = _overwrite;
+    items.clear();
+    items.shrink_to_fit();
+    head = 0;
+    if (spill != nullptr) {
+      fclose(spill);
+      spill = nullptr;
+    }
+  }
+  
+  void push(const event_type& e) {
+    if (items.empty()) {
+      items.resize(capacity);
+    }
+    if ((head == capacity) && (! overwrite)) {
+      flush();
+    }
+    items[head % capacity] = e;
+    head++;
+  }
+  
+  // number of events lost to the overwrite policy
+  uint64_t nb_dropped() const {
+    return (head > capacity) ? head - capacity : 0;
+  }
+  
+  // number of events held in memory
+  size_t size() const {
+    return std::min(head, (uint64_t)capacity);
+  }
+  
+  // i-th oldest event held in memory
+  const event_type& operator[](size_t i) const {
+    size_t start = (head > capacity) ? head % capacity : 0;
+    return items[(start + i) % capacity];
+  }
+  
+  FILE* get_spill() const {
+    return spill;
+  }
+  
+};
+
+// iterates, in order, over the events of one worker: first those that
+// were spilled to file, then those held in memory
+class event_cursor_type {
+private:
+  
+  static constexpr
+  size_t chunk_capacity = 4096;
   
-using buffer_type = std::vector<event_type>;
+  const event_ring_type* ring = nullptr;
   
-using time_point_type = std::chrono::time_point<std::chrono::system_clock>;
+  std::vector<event_type> chunk;
+  
+  size_t chunk_pos = 0;
+  
+  bool reading_spill = false;
+  
+  size_t ring_pos = 0;
+  
+public:
+  
+  void reset(const event_ring_type* _ring) {
+    ring = _ring;
+    chunk.clear();
+    chunk_pos = 0;
+    ring_pos = 0;
+    reading_spill = (ring->get_spill() != nullptr);
+    if (reading_spill) {
+      fflush(ring->get_spill());
+      rewind(ring->get_spill());
+    }
+  }
+  
+  bool next(event_type& e) {
+    while (reading_spill) {
+      if (chunk_pos < chunk.size()) {
+        e = chunk[chunk_pos++];
+        return true;
+      }
+      chunk.resize(chunk_capacity);
+      size_t n = fread(chunk.data(), sizeof(event_type), chunk_capacity, ring->get_spill());
+      chunk.resize(n);
+      chunk_pos = 0;
+      reading_spill = (n > 0);
+    }
+    if (ring_pos < ring->size()) {
+      e = (*ring)[ring_pos++];
+      return true;
+    }
+    return false;
+  }
+  
+};
+
+/*---------------------------------------------------------------------*/
+/* Chrome trace output
+ *
+ * Writes events in the Chrome Trace Event format, which can be loaded
+ * by chrome://tracing and by Perfetto. Each worker gets its own track.
+ * Enter/exit events become duration slices, and all other events become
+ * instants. Each steal (frontier_acquire) is drawn as a flow arrow from
+ * the victim to the thief, starting at the latest frontier split made
+ * by the victim since the thief started waiting, if there is one.
+ * Program points are not timed events, and are omitted. Under the
+ * overwrite policy, the oldest events of a worker may be lost, among
+ * which the enter events of slices whose exit events are kept: such
+ * orphaned exits are skipped, so that slices remain balanced.
+ */
+
+class trace_json_writer {
+private:
+  
+  FILE* f;
+  
+  uint64_t basetime;
+  
+  bool first = true;
+  
+  int nb_flows = 0;
+  
+  // per worker, in microseconds
+  std::vector<double> last_split;
+  std::vector<double> last_enter_wait;
+  
+  // per worker, number of slices that are open
+  std::vector<int> nb_open_slices;
+  
+  static
+  std::string escape(const char* s) {
+    std::string r;
+    for (; (s != nullptr) && (*s != '\0'); s++) {
+      if ((*s == '"') || (*s == '\\')) {
+        r += '\\';
+      }
+      r += *s;
+    }
+    return r;
+  }
+  
+  static
+  std::string trimmed_name_of(event_tag_type tag) {
+    std::string n = name_of(tag);
+    while ((! n.empty()) && (n.back() == ' ')) {
+      n.pop_back();
+    }
+    return n;
+  }
+  
+  static
+  const char* name_of_kind(event_kind_type k) {
+    switch (k) {
+      case phases: return "phases";
+      case threads: return "threads";
+      case migration: return "migration";
+      case communicate: return "communicate";
+      case leaf_loop: return "leaf_loop";
+      case program: return "program";
+      case promotion: return "promotion";
+      default: return "unknown";
+    }
+  }
+  
+  // prints the fields that are common to all events, leaving the object open
+  void begin(const char* name, const char* ph, const char* cat, double ts, int tid) {
+    fprintf(f, first ? "\n" : ",\n");
+    first = false;
+    fprintf(f, "{\"name\":\"%s\",\"ph\":\"%s\",\"cat\":\"%s\",\"ts\":%.3lf,\"pid\":0,\"tid\":%d",
+            name, ph, cat, ts, tid);
+  }
+  
+  void duration(const char* name, bool enter, const event_type& e, double ts) {
+    int& nb_open = nb_open_slices[e.worker_id];
+    if (enter) {
+      nb_open++;
+    } else if (nb_open == 0) {
+      return; // the matching enter event was lost
+    } else {
+      nb_open--;
+    }
+    begin(name, enter ? "B" : "E", name_of_kind(kind_of(e.tag)), ts, e.worker_id);
+    fprintf(f, "}");
+  }
+  
+  void instant(const event_type& e, double ts) {
+    begin(trimmed_name_of(e.tag).c_str(), "i", name_of_kind(kind_of(e.tag)), ts, e.worker_id);
+    fprintf(f, ",\"s\":\"t\"");
+  }
+  
+public:
+  
+  trace_json_writer(FILE* f, uint64_t basetime, int nb_workers)
+  : f(f), basetime(basetime), last_split(nb_workers, -1.0), last_enter_wait(nb_workers, -1.0),
+    nb_open_slices(nb_workers, 0) {
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int id = 0; id < nb_workers; id++) {
+      begin("thread_name", "M", "threads", 0.0, id);
+      fprintf(f, ",\"args\":{\"name\":\"worker %d\"}}", id);
+    }
+  }
+  
+  void write(const event_type& e) {
+    double ts = e.timestamp_usec(basetime);
+    int w = e.worker_id;
+    switch (e.tag) {
+      case enter_launch:
+      case exit_launch: {
+        duration("launch", e.tag == enter_launch, e, ts);
+        break;
+      }
+      case enter_algo:
+      case exit_algo: {
+        duration("algo", e.tag == enter_algo, e, ts);
+        break;
+      }
+      case enter_wait:
+      case exit_wait: {
+        if (e.tag == enter_wait) {
+          last_enter_wait[w] = ts;
+        }
+        duration("wait", e.tag == enter_wait, e, ts);
+        break;
+      }
+      case frontier_split: {
+        last_split[w] = ts;
+        instant(e, ts);
+        fprintf(f, ",\"args\":{\"nb_strands_kept\":%d,\"nb_strands_given\":%d}}",
+                e.extra.n1, e.extra.n2);
+        break;
+      }
+      case frontier_acquire: {
+        int k = e.extra.n1;
+        instant(e, ts);
+        fprintf(f, ",\"args\":{\"victim\":%d}}", k);
+        double start = ts;
+        if ((k >= 0) && (k < last_split.size()) && (last_split[k] >= last_enter_wait[w])) {
+          start = last_split[k];
+        }
+        int id = nb_flows++;
+        begin("steal", "s", "migration", start, k);
+        fprintf(f, ",\"id\":%d}", id);
+        begin("steal", "f", "migration", ts, w);
+        fprintf(f, ",\"id\":%d,\"bp\":\"e\"}", id);
+        break;
+      }
+      case leaf_loop_update: {
+        instant(e, ts);
+        fprintf(f, ",\"args\":{\"nb_iters\":%d,\"nb_iters_new\":%d,\"elapsed_usec\":%.3lf,\"estimator\":\"%p\"}}",
+                e.extra.leaf_loop.nb_iters,
+                e.extra.leaf_loop.nb_iters_new,
+                machine::microseconds_of_cycles(e.extra.leaf_loop.elapsed),
+                e.extra.leaf_loop.estimator);
+        break;
+      }
+      case promote_spawn2_join:
+      case promote_spawn_minus:
+      case promote_spawn_plus:
+      case promote_join_plus:
+      case promote_loop_split_join_trivial:
+      case promote_loop_split_join_associative_combine: {
+        instant(e, ts);
+        fprintf(f, ",\"args\":{\"caller\":\"%s\"}}",
+                escape(e.extra.promotion.caller_name).c_str());
+        break;
+      }
+      case program_point: {
+        break;
+      }
+      default: {
+        instant(e, ts);
+        fprintf(f, "}");
+      }
+    }
+  }
+  
+  void close() {
+    fprintf(f, "\n]}\n");
+  }
+  
+};
 
 static constexpr
 int max_nb_ppts = 50000;
@@ -225,13 +557,13 @@ public:
   bool real_time;
   
   static
-  data::perworker::array<buffer_type> buffers;
+  data::perworker::array<event_ring_type> buffers;
   
   static
   bool tracking_kind[nb_kinds];
   
   static
-  time_point_type basetime;
+  uint64_t basetime;
 
   static
   program_point_type ppts[max_nb_ppts];
@@ -255,7 +587,27 @@ public:
     if (pview) {
       tracking_kind[phases] = true;
     }
-    basetime = std::chrono::system_clock::now();
+    if (deepsea::cmdline::parse_or_default_string("log_trace_json", "") != "") {
+      tracking_kind[phases] = true;
+      tracking_kind[migration] = true;
+      tracking_kind[leaf_loop] = true;
+      tracking_kind[program] = true;
+      tracking_kind[promotion] = true;
+    }
+    int capacity = deepsea::cmdline::parse_or_default_int("log_buffer_capacity", 1 << 16);
+    bool overwrite = false;
+    deepsea::cmdline::dispatcher d;
+    d.add("flush", [&] {
+      overwrite = false;
+    });
+    d.add("overwrite", [&] {
+      overwrite = true;
+    });
+    d.dispatch_or_default("log_buffer_policy", "flush");
+    buffers.for_each([&] (int, event_ring_type& b) {
+      b.reset(capacity, overwrite);
+    });
+    basetime = cycles::now();
     push(event_type(enter_launch));
   }
   
@@ -269,71 +621,109 @@ public:
     if (! tracking_kind[k]) {
       return;
     }
-    std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - basetime;
-    e.timestamp = elapsed.count() * 1000000;
+    e.timestamp = cycles::now();
     e.worker_id = data::perworker::get_my_id();
     if (real_time) {
       atomic::acquire_print_lock();
-      e.print_text(stdout);
+      e.print_text(stdout, basetime);
       atomic::release_print_lock();
     }
-    buffers.mine().push_back(e);
+    buffers.mine().push(e);
   }
   
+  // applies body to every logged event, in the order of their timestamps
+  template <class Body>
   static
-  void output_bytes(buffer_type& b) {
-    bool pview = deepsea::cmdline::parse_or_default_bool("pview", false);
-    auto dflt = pview ? "LOG_BIN" : "";
-    std::string fname = deepsea::cmdline::parse_or_default_string("log_bytes_fname", dflt);
-    if (fname == "") {
-      return;
+  void for_each_event(const Body& body) {
+    int nb_workers = data::perworker::get_nb_workers();
+    std::vector<event_cursor_type> cursors(nb_workers);
+    std::vector<event_type> heads(nb_workers);
+    using item_type = std::pair<uint64_t, int>;
+    std::priority_queue<item_type, std::vector<item_type>, std::greater<item_type>> q;
+    for (auto id = 0; id != nb_workers; id++) {
+      cursors[id].reset(&buffers[id]);
+      if (cursors[id].next(heads[id])) {
+        q.push(std::make_pair(heads[id].timestamp, id));
+      }
     }
-    FILE* f = fopen(fname.c_str(), "w");
-    for (auto e : b) {
-      e.print_byte(f);
+    while (! q.empty()) {
+      int id = q.top().second;
+      q.pop();
+      body(heads[id]);
+      if (cursors[id].next(heads[id])) {
+        q.push(std::make_pair(heads[id].timestamp, id));
+      }
     }
-    fclose(f);
   }
   
   static
-  void output_text(buffer_type& b) {
-    std::string fname = deepsea::cmdline::parse_or_default_string("log_text_fname", "");
+  FILE* open_output(std::string fname) {
     if (fname == "") {
-      return;
+      return nullptr;
     }
     FILE* f = fopen(fname.c_str(), "w");
-    for (auto e : b) {
-      e.print_text(f);
+    if (f == nullptr) {
+      atomic::die("failed to open %s\n", fname.c_str());
     }
-    fclose(f);
+    return f;
   }
   
   static
   void output() {
+    if (! enabled) {
+      return;
+    }
     push(event_type(exit_launch));
     for (auto i = 0; i < nb_ppts; i++) {
       event_type e(program_point);
       e.extra.ppt = ppts[i];
       push(e);
     }
-    buffer_type b;
-    for (auto id = 0; id != data::perworker::get_nb_workers(); id++) {
-      buffer_type& b_id = buffers[id];
-      for (auto e : b_id) {
-        b.push_back(e);
-      }
+    bool pview = deepsea::cmdline::parse_or_default_bool("pview", false);
+    auto dflt = pview ? "LOG_BIN" : "";
+    FILE* f_bytes = open_output(deepsea::cmdline::parse_or_default_string("log_bytes_fname", dflt));
+    FILE* f_text = open_output(deepsea::cmdline::parse_or_default_string("log_text_fname", ""));
+    FILE* f_json = open_output(deepsea::cmdline::parse_or_default_string("log_trace_json", ""));
+    std::unique_ptr<trace_json_writer> json;
+    if (f_json != nullptr) {
+      json.reset(new trace_json_writer(f_json, basetime, data::perworker::get_nb_workers()));
+    }
+    if ((f_bytes != nullptr) || (f_text != nullptr) || (f_json != nullptr)) {
+      for_each_event([&] (event_type& e) {
+        if (f_bytes != nullptr) {
+          e.print_byte(f_bytes, basetime);
+        }
+        if (f_text != nullptr) {
+          e.print_text(f_text, basetime);
+        }
+        if (json) {
+          json->write(e);
+        }
+      });
     }
-    std::stable_sort(b.begin(), b.end(), [] (const event_type& e1, const event_type& e2) {
-      return e1.timestamp < e2.timestamp;
+    if (f_bytes != nullptr) {
+      fclose(f_bytes);
+    }
+    if (f_text != nullptr) {
+      fclose(f_text);
+    }
+    if (f_json != nullptr) {
+      json->close();
+      fclose(f_json);
+    }
+    uint64_t nb_dropped = 0;
+    buffers.for_each([&] (int, event_ring_type& b) {
+      nb_dropped += b.nb_dropped();
     });
-    output_bytes(b);
-    output_text(b);
+    if (nb_dropped > 0) {
+      fprintf(stderr, "warning: %llu log events were overwritten\n", (unsigned long long)nb_dropped);
+    }
   }
   
 };
   
 template <bool enabled>
-data::perworker::array<buffer_type> logging_base<enabled>::buffers;
+data::perworker::array<event_ring_type> logging_base<enabled>::buffers;
 
 template <bool enabled>
 bool logging_base<enabled>::tracking_kind[nb_kinds];
@@ -348,7 +738,7 @@ template <bool enabled>
 program_point_type logging_base<enabled>::ppts[max_nb_ppts];
 
 template <bool enabled>
-time_point_type logging_base<enabled>::basetime;
+uint64_t logging_base<enabled>::basetime;
 
 #ifdef ENCORE_ENABLE_LOGGING
 using log_buffer = logging_base<true>;
@@ -1,5 +1,22 @@
 
 #include <assert.h>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cmath>
+#include <time.h>
+
+#ifdef TARGET_LINUX
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 #ifdef HAVE_HWLOC
 #include <hwloc.h>
@@ -12,6 +29,7 @@
 
 #include "cmdline.hpp"
 #include "atomic.hpp"
+#include "cycles.hpp"
 
 #ifndef _ENCORE_MACHINE_H_
 #define _ENCORE_MACHINE_H_
@@ -42,29 +60,245 @@ void initialize_hwloc(int nb_workers) {
 #endif
 }
 
+/*---------------------------------------------------------------------*/
+/* Worker count and placement
+ *
+ * The default number of workers is the number of CPUs that the process
+ * may actually use: those in its affinity mask, further capped by the
+ * CPU quota of its cgroup (cgroup v2 cpu.max). When that number is not
+ * exceeded, each worker is pinned to a distinct allowed CPU (unless
+ * -pin_workers 0 is given). When it is, the runtime warns, and the
+ * scheduler yields the CPU in its spin loops instead of busy waiting,
+ * because a preempted worker may be the one that the spinning workers
+ * wait for.
+ */
+
+std::vector<int> allowed_cpus;
+
+#ifdef TARGET_LINUX
+cpu_set_t initial_affinity;
+#endif
+
+bool pin_workers = false;
+
+bool oversubscribed = false;
+
+#ifdef TARGET_LINUX
+// returns the CPU quota in the file cpu.max of the given cgroup directory,
+// or zero if there is no such quota
+double read_cpu_max(const std::string& dir) {
+  FILE* f = fopen((dir + "/cpu.max").c_str(), "r");
+  if (f == nullptr) {
+    return 0.0;
+  }
+  char quota[64];
+  unsigned long period = 0;
+  double result = 0.0;
+  if ((fscanf(f, "%63s %lu", quota, &period) == 2) &&
+      (std::string(quota) != "max") && (period > 0)) {
+    result = atof(quota) / (double)period;
+  }
+  fclose(f);
+  return result;
+}
+#endif
+
+// returns the number of CPUs granted by the cgroup CPU quotas that apply
+// to the process, or zero if there is none
+double cgroup_cpu_quota() {
+  double result = 0.0;
+#ifdef TARGET_LINUX
+  FILE* f = fopen("/proc/self/cgroup", "r");
+  if (f == nullptr) {
+    return 0.0;
+  }
+  char buf[4096];
+  std::string path;
+  while (fgets(buf, sizeof(buf), f) != nullptr) {
+    std::string line(buf);
+    if (line.compare(0, 3, "0::") == 0) {
+      path = line.substr(3);
+      while ((! path.empty()) && ((path.back() == '\n') || (path.back() == '/'))) {
+        path.pop_back();
+      }
+      break;
+    }
+  }
+  fclose(f);
+  // the quota of each ancestor applies as well
+  while (true) {
+    double q = read_cpu_max("/sys/fs/cgroup" + path);
+    if ((q > 0.0) && ((result == 0.0) || (q < result))) {
+      result = q;
+    }
+    if (path.empty()) {
+      break;
+    }
+    path = path.substr(0, path.rfind('/'));
+  }
+#endif
+  return result;
+}
+
+void initialize_placement() {
+  allowed_cpus.clear();
+#ifdef TARGET_LINUX
+  CPU_ZERO(&initial_affinity);
+  if (sched_getaffinity(0, sizeof(initial_affinity), &initial_affinity) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &initial_affinity)) {
+        allowed_cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+}
+
+int nb_available_cpus() {
+  int nb = (int)allowed_cpus.size();
+  if (nb == 0) {
+    nb = std::max(1, (int)std::thread::hardware_concurrency());
+  }
+  double quota = cgroup_cpu_quota();
+  if (quota > 0.0) {
+    nb = std::min(nb, std::max(1, (int)std::ceil(quota)));
+  }
+  return nb;
+}
+
+int default_nb_workers() {
+  static int nb = -1;
+  if (nb == -1) {
+    nb = nb_available_cpus();
+  }
+  return nb;
+}
+
+// returns the number of workers requested by -proc, or the default one
+int get_nb_workers() {
+  return cmdline::parse_or_default("proc", default_nb_workers());
+}
+
+// to be called before the workers are launched
+void on_enter_launch(int nb_workers) {
+  int nb_available = default_nb_workers();
+  oversubscribed = (nb_workers > nb_available);
+  if (oversubscribed) {
+    fprintf(stderr, "warning: %d workers requested, but only %d CPUs are available; "
+            "workers will yield instead of spinning\n", nb_workers, nb_available);
+  }
+  pin_workers = (! oversubscribed)
+             && (nb_workers <= allowed_cpus.size())
+             && cmdline::parse_or_default_bool("pin_workers", true);
+}
+
+// returns the CPU on which worker id runs when workers are pinned, or
+// -1 if there is none
+int cpu_of_worker(int id) {
+  return (id < allowed_cpus.size()) ? allowed_cpus[id] : -1;
+}
+
+void pin_calling_thread(int cpu) {
+#ifdef TARGET_LINUX
+  if (cpu < 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+}
+
+// to be called by each worker thread, before it starts working
+void initialize_worker(int id) {
+  if (! pin_workers) {
+    return;
+  }
+  pin_calling_thread(cpu_of_worker(id));
+}
+
+// to be called by the thread that launched the workers, after they are done
+void on_exit_launch() {
+#ifdef TARGET_LINUX
+  if (! pin_workers) {
+    return;
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(initial_affinity), &initial_affinity);
+#endif
+}
+
+// to be called in each iteration of a spin loop
+static inline
+void relax() {
+  if (oversubscribed) {
+    std::this_thread::yield();
+  }
+}
+
 void initialize_hwloc() {
-  initialize_hwloc(cmdline::parse_or_default("proc", 1));
+  initialize_hwloc(get_nb_workers());
 }
 
+/*---------------------------------------------------------------------*/
+/* Cycle counter calibration
+ *
+ * cpu_frequency_ghz is the rate, in ticks per nanosecond, of the
+ * counter read by cycles::now(). On machines with an invariant TSC,
+ * that is the rate of the TSC, which is measured against
+ * CLOCK_MONOTONIC_RAW (the frequency reported by /proc/cpuinfo is the
+ * current, scaled, frequency of the core, which may differ by a factor
+ * of two or more). Otherwise, cycles::now() falls back to
+ * CLOCK_MONOTONIC_RAW itself, and the rate is one tick per nanosecond.
+ */
+
 double cpu_frequency_ghz = 1.2;
-  
+
+bool has_invariant_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (! __get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007)) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1 << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+// returns the rate of the TSC, in GHz
+double calibrate_tsc(double duration_msec) {
+  static constexpr
+  int nb_rounds = 5;
+  double rates[nb_rounds];
+  for (int i = 0; i < nb_rounds; i++) {
+    uint64_t t0 = cycles::monotonic_clock_nsec();
+    uint64_t c0 = cycles::rdtsc();
+    uint64_t t1;
+    do {
+      t1 = cycles::monotonic_clock_nsec();
+    } while ((t1 - t0) < (uint64_t)(duration_msec * 1000000.0));
+    uint64_t c1 = cycles::rdtsc();
+    rates[i] = (double)(c1 - c0) / (double)(t1 - t0);
+  }
+  std::sort(rates, rates + nb_rounds);
+  return rates[nb_rounds / 2];
+}
+
 void initialize_cpuinfo() {
-  float cpu_frequency_mhz = 0.0;
 #ifdef TARGET_LINUX
-  /* Get information from /proc/cpuinfo.     *
-   * cpu MHz         : <float>             # cpu frequency in MHz
-   */
-  FILE *cpuinfo_file = fopen("/proc/cpuinfo", "r");
-  char buf[1024];
-  int cache_line_szb;
-  if (cpuinfo_file != NULL) {
-    while (fgets(buf, sizeof(buf), cpuinfo_file) != 0) {
-      sscanf(buf, "cpu MHz : %f", &(cpu_frequency_mhz));
-    }
-    fclose (cpuinfo_file);
+  if (has_invariant_tsc()) {
+    double duration_msec = cmdline::parse_or_default_double("tsc_calibration_msec", 10.0);
+    cpu_frequency_ghz = calibrate_tsc(duration_msec);
+  } else {
+    fprintf(stderr, "warning: no invariant TSC; timing with CLOCK_MONOTONIC_RAW\n");
+    cycles::use_monotonic_clock = true;
+    cpu_frequency_ghz = 1.0;
   }
 #endif
 #ifdef TARGET_MAC_OS
+  float cpu_frequency_mhz = 0.0;
   uint64_t freq = 0;
   size_t size;
   size = sizeof(freq);
@@ -72,11 +306,26 @@ void initialize_cpuinfo() {
     perror("sysctl");
   }
   cpu_frequency_mhz = (float)freq / 1000000.;
-#endif
   if (cpu_frequency_mhz == 0.) {
     atomic::die("Failed to read CPU frequency\n");
   }
   cpu_frequency_ghz = (double) (cpu_frequency_mhz / 1000.0);
+#endif
+}
+
+static inline
+double seconds_of_cycles(uint64_t nb_cycles) {
+  return (double)nb_cycles / (cpu_frequency_ghz * 1000000000.0);
+}
+
+static inline
+double microseconds_of_cycles(uint64_t nb_cycles) {
+  return (double)nb_cycles / (cpu_frequency_ghz * 1000.0);
+}
+
+static inline
+uint64_t cycles_of_microseconds(double usec) {
+  return (uint64_t)(usec * cpu_frequency_ghz * 1000.0);
 }
   
 } // end namespace
@@ -0,0 +1,242 @@
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+#ifdef TARGET_LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "perworker.hpp"
+#include "cmdline.hpp"
+#include "stats.hpp"
+#include "metricsshm.hpp"
+
+#ifndef _ENCORE_METRICS_H_
+#define _ENCORE_METRICS_H_
+
+namespace encore {
+namespace metrics {
+
+/*---------------------------------------------------------------------*/
+/* Live metrics exporter
+ *
+ * When -metrics_shm <name> is given, a background thread publishes,
+ * every -metrics_interval_ms milliseconds, the statistics counters and
+ * idle time of each worker, along with the length of its ready queue
+ * and its number of I/O requests in flight, to the POSIX shared-memory
+ * segment <name> (see metricsshm.hpp for its layout, and
+ * tools/encore-top.cpp for a reader).
+ *
+ * Workers never take locks: the counters are read by the exporter with
+ * relaxed loads, and the gauges, which only the worker that owns the
+ * queue may compute, are published by the worker itself, with relaxed
+ * stores, once per iteration of its scheduler loop.
+ */
+
+template <bool enabled>
+class metrics_base {
+private:
+
+  class gauges_type {
+  public:
+    std::atomic<int64_t> nb_ready;
+    std::atomic<int64_t> nb_pending_io;
+  };
+
+  static
+  bool active;
+
+  static
+  std::atomic<bool> stop_requested;
+
+  static
+  std::thread* exporter;
+
+  static
+  data::perworker::array<gauges_type> gauges;
+
+  static
+  std::string shm_name;
+
+  static
+  segment_header_type* segment;
+
+  static
+  size_t segment_szb;
+
+  static
+  std::chrono::time_point<std::chrono::steady_clock> start_time;
+
+  static
+  void publish(bool finished) {
+    auto nb_workers = std::min((uint64_t)segment->nb_workers,
+                               (uint64_t)data::perworker::get_nb_workers());
+    worker_record_type* workers = workers_of(segment);
+    segment->seq.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int id = 0; id < nb_workers; id++) {
+      worker_record_type& w = workers[id];
+      for (int i = 0; i < segment->nb_counters; i++) {
+        w.counters[i] = stats::peek_counter(id, (stats::counter_id_type)i);
+      }
+      w.idle_time = stats::peek_idle_time(id);
+      w.nb_ready = gauges[id].nb_ready.load(std::memory_order_relaxed);
+      w.nb_pending_io = gauges[id].nb_pending_io.load(std::memory_order_relaxed);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    segment->elapsed = elapsed.count();
+    segment->nb_publications++;
+    segment->finished = finished ? 1 : 0;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    segment->seq.fetch_add(1);
+  }
+
+  static
+  bool open_segment(int nb_workers, int interval_ms) {
+#ifdef TARGET_LINUX
+    segment_szb = segment_size(nb_workers);
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+      return false;
+    }
+    if (ftruncate(fd, segment_szb) == -1) {
+      close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, segment_szb, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    memset(p, 0, segment_szb);
+    segment = (segment_header_type*)p;
+    segment->nb_workers = nb_workers;
+    segment->pid = (uint64_t)getpid();
+    segment->interval_ms = interval_ms;
+    segment->nb_counters = std::min((int)stats::nb_counters, max_nb_counters);
+    for (int i = 0; i < segment->nb_counters; i++) {
+      const char* name = stats::name_of_counter((stats::counter_id_type)i);
+      strncpy(segment->counter_names[i], name, counter_name_capacity - 1);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    segment->magic = segment_magic;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  static
+  void close_segment() {
+#ifdef TARGET_LINUX
+    munmap(segment, segment_szb);
+    shm_unlink(shm_name.c_str());
+#endif
+    segment = nullptr;
+  }
+
+public:
+
+  static
+  void initialize() {
+    if (! enabled) {
+      return;
+    }
+    shm_name = deepsea::cmdline::parse_or_default_string("metrics_shm", "");
+    active = false;
+    gauges.for_each([&] (int, gauges_type& g) {
+      g.nb_ready.store(0);
+      g.nb_pending_io.store(0);
+    });
+  }
+
+  // to be called before the workers are launched
+  static
+  void on_enter_launch(int nb_workers) {
+    if ((! enabled) || (shm_name == "")) {
+      return;
+    }
+    int interval_ms = deepsea::cmdline::parse_or_default_int("metrics_interval_ms", 100);
+    if (! open_segment(nb_workers, interval_ms)) {
+      fprintf(stderr, "warning: failed to create metrics segment %s\n", shm_name.c_str());
+      return;
+    }
+    active = true;
+    start_time = std::chrono::steady_clock::now();
+    stop_requested.store(false);
+    exporter = new std::thread([=] {
+      while (! stop_requested.load()) {
+        publish(false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+      }
+    });
+  }
+
+  // to be called after all workers have stopped
+  static
+  void on_exit_launch() {
+    if ((! enabled) || (! active)) {
+      return;
+    }
+    stop_requested.store(true);
+    exporter->join();
+    delete exporter;
+    exporter = nullptr;
+    publish(true);
+    close_segment();
+    active = false;
+  }
+
+  // to be called by each worker once per iteration of its scheduler loop
+  static inline
+  void on_scheduler_loop(int64_t nb_ready, int64_t nb_pending_io) {
+    if ((! enabled) || (! active)) {
+      return;
+    }
+    gauges_type& g = gauges.mine();
+    g.nb_ready.store(nb_ready, std::memory_order_relaxed);
+    g.nb_pending_io.store(nb_pending_io, std::memory_order_relaxed);
+  }
+
+};
+
+template <bool enabled>
+bool metrics_base<enabled>::active = false;
+
+template <bool enabled>
+std::atomic<bool> metrics_base<enabled>::stop_requested;
+
+template <bool enabled>
+std::thread* metrics_base<enabled>::exporter = nullptr;
+
+template <bool enabled>
+data::perworker::array<typename metrics_base<enabled>::gauges_type> metrics_base<enabled>::gauges;
+
+template <bool enabled>
+std::string metrics_base<enabled>::shm_name;
+
+template <bool enabled>
+segment_header_type* metrics_base<enabled>::segment = nullptr;
+
+template <bool enabled>
+size_t metrics_base<enabled>::segment_szb = 0;
+
+template <bool enabled>
+std::chrono::time_point<std::chrono::steady_clock> metrics_base<enabled>::start_time;
+
+#ifdef ENCORE_ENABLE_STATS
+using publisher = metrics_base<true>;
+#else
+using publisher = metrics_base<false>;
+#endif
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_METRICS_H_ */
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _ENCORE_METRICSSHM_H_
+#define _ENCORE_METRICSSHM_H_
+
+namespace encore {
+namespace metrics {
+
+/*---------------------------------------------------------------------*/
+/* Layout of the live metrics segment
+ *
+ * The segment is written by a single exporter thread, and read by any
+ * number of external processes. Consistency of a snapshot is ensured
+ * by a sequence lock: the exporter makes seq odd before it updates the
+ * segment, and even after. A reader copies the segment, and retries if
+ * seq was odd or changed during the copy.
+ *
+ * This header is shared with the reader tool, and so depends only on
+ * the standard library.
+ */
+
+static constexpr
+uint64_t segment_magic = 0x454e434f52454d33; // "ENCOREM3"
+
+static constexpr
+int max_nb_counters = 8;
+
+static constexpr
+int counter_name_capacity = 32;
+
+class segment_header_type {
+public:
+
+  uint64_t magic;
+
+  std::atomic<uint64_t> seq;
+
+  uint64_t nb_workers;
+
+  uint64_t nb_counters;
+
+  char counter_names[max_nb_counters][counter_name_capacity];
+
+  // process that publishes the segment
+  uint64_t pid;
+
+  // period of the publications, in milliseconds
+  uint64_t interval_ms;
+
+  // set once the launch has completed
+  uint64_t finished;
+
+  uint64_t nb_publications;
+
+  // seconds since the beginning of the launch
+  double elapsed;
+
+};
+
+class worker_record_type {
+public:
+
+  int64_t counters[max_nb_counters];
+
+  // seconds
+  double idle_time;
+
+  // number of strands (or vertices, depending on the scheduler) in the
+  // ready queue of the worker
+  int64_t nb_ready;
+
+  // number of I/O requests submitted by the worker that are in flight
+  int64_t nb_pending_io;
+
+} __attribute__((aligned(64)));
+
+static inline
+size_t segment_size(size_t nb_workers) {
+  size_t header = (sizeof(segment_header_type) + 63) & ~(size_t)63;
+  return header + nb_workers * sizeof(worker_record_type);
+}
+
+static inline
+worker_record_type* workers_of(segment_header_type* header) {
+  size_t offset = (sizeof(segment_header_type) + 63) & ~(size_t)63;
+  return (worker_record_type*)((char*)header + offset);
+}
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_METRICSSHM_H_ */
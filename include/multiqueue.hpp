@@ -0,0 +1,294 @@
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "perworker.hpp"
+#include "cycles.hpp"
+#include "fuel.hpp"
+#include "stats.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+#include "future.hpp"
+
+#ifndef _ENCORE_MULTIQUEUE_H_
+#define _ENCORE_MULTIQUEUE_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Relaxed priority worklist
+ *
+ * A multiqueue holds items with priorities, smaller first, in a set of
+ * binary heaps, each of which has a lock of its own. An item is pushed
+ * to a random heap, and popped from the better of two random heaps, so
+ * that pops return items whose rank is close to the smallest one, with
+ * high probability, while the workers rarely contend for a lock. A pop
+ * fails only if all of the heaps are found empty.
+ *
+ * parallel_process(q, body) pops the items of q, and runs body(x, p) on
+ * each item x of priority p, until q is empty; the body may push new
+ * items to q. It starts with one processor, i.e., a vertex that pops
+ * and processes items in a loop, and adds another at each heartbeat of
+ * a processor, as long as q holds items to spare and there are fewer
+ * processors than workers, in the way that a heartbeat promotes latent
+ * parallelism.
+ *
+ *   multiqueue<int, long> q;
+ *   q.push(source, 0);
+ *   auto done = parallel_process(q, [&] (int v, long d) {
+ *     ...
+ *     q.push(w, d + weight);
+ *   });
+ *
+ * Priorities are of an integral type. A multiqueue is to be created by
+ * code that runs on a worker, once the workers are known.
+ */
+
+// number of heaps per worker, by default
+int multiqueue_heaps_per_worker = 2;
+
+template <class Item, class Priority>
+class multiqueue {
+public:
+
+  using entry_type = std::pair<Priority, Item>;
+
+private:
+
+  static constexpr
+  Priority empty_priority = std::numeric_limits<Priority>::max();
+
+  class heap_type {
+  public:
+
+    std::mutex mutex;
+
+    std::vector<entry_type> entries;
+
+    // priority of the top entry, or empty_priority; read without the lock
+    std::atomic<Priority> top;
+
+    char _padding[64];
+
+    heap_type() : top(empty_priority) { }
+
+    static
+    bool greater(const entry_type& a, const entry_type& b) {
+      return a.first > b.first;
+    }
+
+    void push(const entry_type& e) {
+      entries.push_back(e);
+      std::push_heap(entries.begin(), entries.end(), greater);
+      top.store(entries.front().first, std::memory_order_relaxed);
+    }
+
+    entry_type pop() {
+      assert(! entries.empty());
+      std::pop_heap(entries.begin(), entries.end(), greater);
+      entry_type e = entries.back();
+      entries.pop_back();
+      top.store(entries.empty() ? empty_priority : entries.front().first,
+                std::memory_order_relaxed);
+      return e;
+    }
+
+  };
+
+  std::vector<std::unique_ptr<heap_type>> heaps;
+
+  std::atomic<long> nb_items;
+
+  data::perworker::array<std::mt19937> rngs;
+
+  int random_heap() {
+    return (int)(rngs.mine()() % heaps.size());
+  }
+
+  // tries to pop from heap h, if it is not empty
+  bool try_pop_from(int h, Item& x, Priority& p) {
+    heap_type& q = *heaps[h];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.entries.empty()) {
+      return false;
+    }
+    auto e = q.pop();
+    nb_items--;
+    p = e.first;
+    x = e.second;
+    return true;
+  }
+
+public:
+
+  // nb_heaps is the number of heaps, or zero for
+  // multiqueue_heaps_per_worker per worker
+  multiqueue(int nb_heaps = 0)
+  : nb_items(0) {
+    if (nb_heaps <= 0) {
+      nb_heaps = multiqueue_heaps_per_worker * std::max(1, data::perworker::get_nb_workers());
+    }
+    nb_heaps = std::max(2, nb_heaps);
+    for (int i = 0; i < nb_heaps; i++) {
+      heaps.emplace_back(new heap_type);
+    }
+    rngs.for_each([&] (int id, std::mt19937& r) {
+      r.seed(id);
+    });
+  }
+
+  multiqueue(const multiqueue&) = delete;
+
+  multiqueue& operator=(const multiqueue&) = delete;
+
+  void push(const Item& x, Priority p) {
+    assert(p != empty_priority);
+    while (true) {
+      heap_type& q = *heaps[random_heap()];
+      std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+      if (lock.owns_lock()) {
+        q.push(std::make_pair(p, x));
+        nb_items++;
+        return;
+      }
+    }
+  }
+
+  // pops an item of small priority; returns false if the multiqueue is
+  // empty
+  bool try_pop(Item& x, Priority& p) {
+    for (int k = 0; k < 4; k++) {
+      int h1 = random_heap();
+      int h2 = random_heap();
+      Priority p1 = heaps[h1]->top.load(std::memory_order_relaxed);
+      Priority p2 = heaps[h2]->top.load(std::memory_order_relaxed);
+      if ((p1 == empty_priority) && (p2 == empty_priority)) {
+        if (nb_items.load() == 0) {
+          return false;
+        }
+        continue;
+      }
+      if (try_pop_from((p1 <= p2) ? h1 : h2, x, p)) {
+        return true;
+      }
+    }
+    // the heaps may be nearly all empty: look at each of them
+    int start = random_heap();
+    for (int i = 0; i < (int)heaps.size(); i++) {
+      if (try_pop_from((start + i) % heaps.size(), x, p)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  long size() const {
+    return nb_items.load();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+};
+
+namespace multiqueues {
+
+template <class Item, class Priority, class Body>
+class shared_state {
+public:
+
+  multiqueue<Item, Priority>& q;
+
+  Body body;
+
+  sched::vertex* join;
+
+  std::atomic<int> nb_processors;
+
+  shared_state(multiqueue<Item, Priority>& q, const Body& body)
+  : q(q), body(body), nb_processors(0) { }
+
+};
+
+template <class Item, class Priority, class Body>
+class processor_vertex : public sched::vertex {
+private:
+
+  using shared_type = shared_state<Item, Priority, Body>;
+
+  std::shared_ptr<shared_type> shared;
+
+  bool completed = false;
+
+public:
+
+  processor_vertex(std::shared_ptr<shared_type> shared)
+  : shared(shared) {
+    shared->nb_processors++;
+  }
+
+  int nb_strands() {
+    return completed ? 0 : 1;
+  }
+
+  fuel::check_type run() {
+    auto& s = *shared;
+    Item x;
+    Priority p;
+    while (s.q.try_pop(x, p)) {
+      s.body(x, p);
+      if ((fuel::check(cycles::now()) == fuel::check_yes_promote) && (s.q.size() >= 2) &&
+          (s.nb_processors.load() < data::perworker::get_nb_workers())) {
+        auto v = new processor_vertex(shared);
+        v->get_outset()->make_unary();
+        sched::new_edge(v, s.join);
+        sched::release(v);
+        sched::schedule(this);
+        stats::on_promotion();
+        return fuel::check_yes_promote;
+      }
+    }
+    s.nb_processors--;
+    completed = true;
+    return fuel::check_no_promote;
+  }
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+} // end namespace
+
+// runs body(x, p) on the items x, of priority p, that are popped from
+// q until q is empty, and returns a future that is set once all are
+// done
+template <class Item, class Priority, class Body>
+future<void> parallel_process(multiqueue<Item, Priority>& q, const Body& body) {
+  auto shared = std::make_shared<multiqueues::shared_state<Item, Priority, Body>>(q, body);
+  auto result = std::make_shared<futures::state_type<void>>();
+  auto f = [shared] { };
+  auto join = new futures::compute_vertex<void, decltype(f)>(result, f);
+  result->control = join->get_outset()->make_chain_future();
+  shared->join = join;
+  auto v = new multiqueues::processor_vertex<Item, Priority, Body>(shared);
+  v->get_outset()->make_unary();
+  sched::new_edge(v, join);
+  sched::release(v);
+  sched::release(join);
+  return future<void>(result);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_MULTIQUEUE_H_ */
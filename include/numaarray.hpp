@@ -0,0 +1,335 @@
+#include <assert.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#ifdef TARGET_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "cmdline.hpp"
+#include "atomic.hpp"
+#include "machine.hpp"
+
+#ifndef _ENCORE_NUMAARRAY_H_
+#define _ENCORE_NUMAARRAY_H_
+
+namespace encore {
+namespace numa {
+
+/*---------------------------------------------------------------------*/
+/* Static block-to-worker mapping
+ *
+ * Splits the index range [0, n) into one block per worker, with each
+ * block boundary falling on a page boundary, so that all the pages of
+ * a block can be placed on the NUMA node of the worker that owns the
+ * block. The last blocks may be empty if n is small.
+ */
+
+class block_mapping {
+private:
+
+  std::size_t n = 0;
+
+  std::size_t block_size = 1;
+
+  int nb_blocks = 1;
+
+public:
+
+  block_mapping() { }
+
+  // items_per_page is the number of items that fit in one page
+  block_mapping(std::size_t n, int nb_blocks, std::size_t items_per_page)
+  : n(n), nb_blocks(std::max(1, nb_blocks)) {
+    items_per_page = std::max((std::size_t)1, items_per_page);
+    std::size_t nb_pages = (n + items_per_page - 1) / items_per_page;
+    std::size_t pages_per_block = (nb_pages + this->nb_blocks - 1) / this->nb_blocks;
+    block_size = std::max((std::size_t)1, pages_per_block * items_per_page);
+  }
+
+  int get_nb_blocks() const {
+    return nb_blocks;
+  }
+
+  std::size_t lo(int block) const {
+    return std::min(n, block * block_size);
+  }
+
+  std::size_t hi(int block) const {
+    return std::min(n, (block + 1) * block_size);
+  }
+
+  // returns the block, and therefore the worker, that owns index i
+  int block_of(std::size_t i) const {
+    assert(i < n);
+    return (int)(i / block_size);
+  }
+
+};
+
+/*---------------------------------------------------------------------*/
+/* Page allocation */
+
+using page_type = enum {
+  standard_pages,
+  huge_pages
+};
+
+static constexpr
+std::size_t huge_page_szb = 2 * 1024 * 1024;
+
+// arrays smaller than this many bytes are initialized by the calling
+// thread alone
+static constexpr
+std::size_t min_parallel_first_touch_szb = 4 * 1024 * 1024;
+
+std::size_t page_szb(page_type pages) {
+  if (pages == huge_pages) {
+    return huge_page_szb;
+  }
+#ifdef TARGET_LINUX
+  return (std::size_t)sysconf(_SC_PAGESIZE);
+#else
+  return 4096;
+#endif
+}
+
+page_type default_page_type() {
+  bool b = deepsea::cmdline::parse_or_default_bool("numa_huge_pages", false);
+  return b ? huge_pages : standard_pages;
+}
+
+// returns szb rounded up to a multiple of the page size
+std::size_t mapping_szb(std::size_t szb, page_type pages) {
+  std::size_t p = page_szb(pages);
+  return std::max(p, ((szb + p - 1) / p) * p);
+}
+
+// allocates szb bytes of untouched pages, which are placed on a NUMA
+// node only when first written to
+void* allocate(std::size_t szb, page_type pages) {
+  void* p = nullptr;
+#ifdef TARGET_LINUX
+  szb = mapping_szb(szb, pages);
+  if (pages == huge_pages) {
+    // over-allocate, so as to align the mapping on a huge page
+    std::size_t padded_szb = szb + huge_page_szb;
+    char* q = (char*)mmap(nullptr, padded_szb, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED) {
+      atomic::die("numa::allocate: mmap failed\n");
+    }
+    char* r = (char*)((((uintptr_t)q) + huge_page_szb - 1) & ~(uintptr_t)(huge_page_szb - 1));
+    if (r != q) {
+      munmap(q, r - q);
+    }
+    char* end = q + padded_szb;
+    if (r + szb != end) {
+      munmap(r + szb, end - (r + szb));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(r, szb, MADV_HUGEPAGE);
+#endif
+    p = r;
+  } else {
+    p = mmap(nullptr, szb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      atomic::die("numa::allocate: mmap failed\n");
+    }
+  }
+#ifdef HAVE_HWLOC
+  // the process-wide interleaving policy set by initialize_hwloc would
+  // otherwise override the placement by first touch
+  hwloc_set_area_membind(machine::topology, p, szb,
+                         hwloc_topology_get_topology_cpuset(machine::topology),
+                         HWLOC_MEMBIND_FIRSTTOUCH, 0);
+#endif
+#else
+  p = malloc(szb);
+  if (p == nullptr) {
+    atomic::die("numa::allocate: malloc failed\n");
+  }
+#endif
+  return p;
+}
+
+void deallocate(void* p, std::size_t szb, page_type pages) {
+#ifdef TARGET_LINUX
+  munmap(p, mapping_szb(szb, pages));
+#else
+  free(p);
+#endif
+}
+
+// calls body(block, lo, hi) for each block of the mapping, on a thread
+// that runs on the CPU of the worker that owns the block
+template <class Body>
+void for_each_block_on_its_worker(const block_mapping& mapping, const Body& body) {
+  std::vector<std::thread> threads;
+  for (int b = 0; b < mapping.get_nb_blocks(); b++) {
+    threads.push_back(std::thread([&, b] {
+      machine::pin_calling_thread(machine::cpu_of_worker(b));
+      body(b, mapping.lo(b), mapping.hi(b));
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+} // end namespace
+
+/*---------------------------------------------------------------------*/
+/* NUMA-aware array
+ *
+ * An array of n items, which is split in one block per worker (see
+ * numa::block_mapping above), and whose items are constructed, and
+ * pages thereby placed, by a thread that runs on the CPU of the worker
+ * that owns the block. This placement is effective when the workers
+ * are pinned (see machine.hpp), and is meant to be matched by code
+ * that accesses block b mostly from worker b, using get_mapping().
+ *
+ * The pages are backed by transparent huge pages when pages is
+ * numa::huge_pages, which by default is when -numa_huge_pages is given.
+ */
+
+template <class Item>
+class numa_array {
+private:
+
+  Item* items = nullptr;
+
+  std::size_t n = 0;
+
+  numa::page_type pages = numa::standard_pages;
+
+  numa::block_mapping mapping;
+
+  template <class Init>
+  void first_touch(const Init& init) {
+    auto body = [&] (int, std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; i++) {
+        init(items + i);
+      }
+    };
+    if (n * sizeof(Item) < numa::min_parallel_first_touch_szb) {
+      body(0, 0, n);
+    } else {
+      numa::for_each_block_on_its_worker(mapping, body);
+    }
+  }
+
+  void allocate(std::size_t _n, numa::page_type _pages) {
+    n = _n;
+    pages = _pages;
+    std::size_t items_per_page = std::max((std::size_t)1, numa::page_szb(pages) / sizeof(Item));
+    mapping = numa::block_mapping(n, machine::get_nb_workers(), items_per_page);
+    items = (Item*)numa::allocate(std::max((std::size_t)1, n * sizeof(Item)), pages);
+  }
+
+  void clear() {
+    if (items == nullptr) {
+      return;
+    }
+    if (! std::is_trivially_destructible<Item>::value) {
+      for (std::size_t i = 0; i < n; i++) {
+        items[i].~Item();
+      }
+    }
+    numa::deallocate(items, std::max((std::size_t)1, n * sizeof(Item)), pages);
+    items = nullptr;
+    n = 0;
+  }
+
+public:
+
+  numa_array() { }
+
+  numa_array(std::size_t n, numa::page_type pages = numa::default_page_type()) {
+    allocate(n, pages);
+    first_touch([&] (Item* p) {
+      new (p) Item();
+    });
+  }
+
+  numa_array(std::size_t n, const Item& x, numa::page_type pages = numa::default_page_type()) {
+    allocate(n, pages);
+    first_touch([&] (Item* p) {
+      new (p) Item(x);
+    });
+  }
+
+  numa_array(const numa_array&) = delete;
+
+  numa_array& operator=(const numa_array&) = delete;
+
+  numa_array(numa_array&& other)
+  : items(other.items), n(other.n), pages(other.pages), mapping(other.mapping) {
+    other.items = nullptr;
+    other.n = 0;
+  }
+
+  numa_array& operator=(numa_array&& other) {
+    if (this != &other) {
+      clear();
+      items = other.items;
+      n = other.n;
+      pages = other.pages;
+      mapping = other.mapping;
+      other.items = nullptr;
+      other.n = 0;
+    }
+    return *this;
+  }
+
+  ~numa_array() {
+    clear();
+  }
+
+  Item& operator[](std::size_t i) {
+    assert(i < n);
+    return items[i];
+  }
+
+  const Item& operator[](std::size_t i) const {
+    assert(i < n);
+    return items[i];
+  }
+
+  Item* data() {
+    return items;
+  }
+
+  Item* begin() {
+    return items;
+  }
+
+  Item* end() {
+    return items + n;
+  }
+
+  std::size_t size() const {
+    return n;
+  }
+
+  const numa::block_mapping& get_mapping() const {
+    return mapping;
+  }
+
+  // returns the worker that owns the page of the i-th item
+  int worker_of(std::size_t i) const {
+    return mapping.block_of(i);
+  }
+
+};
+
+} // end namespace
+
+#endif /*! _ENCORE_NUMAARRAY_H_ */
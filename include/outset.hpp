@@ -699,7 +699,7 @@ public:
   void notify(const Visit& visit) {
     switch (tag) {
       case outset_tag_unary: {
-        incounter::decrement(u.unary);
+        visit(u.unary);
         u.unary = incounter_handle();
         break;
       }
@@ -0,0 +1,339 @@
+#include <utility>
+#include <type_traits>
+
+#include "edsl.hpp"
+
+#ifndef _ENCORE_PARALLEL_H_
+#define _ENCORE_PARALLEL_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Lambda-based parallel primitives
+ *
+ * Each of the functions below pushes on the given stack a call to an
+ * activation record that is generated from its lambda arguments, and
+ * returns the resulting stack. They are to be used wherever the DSL
+ * expects a call, e.g., in the body of a dc::spawn_join, or in the
+ * function given to launch_interpreter_via_lambda:
+ *
+ *   encore::launch_interpreter_via_lambda([&] (encore::stack_type st) {
+ *     return encore::parallel_for(st, 0, n, [&] (int i) {
+ *       a[i] = 0;
+ *     });
+ *   });
+ *
+ * The generated activation records are those that one would write by
+ * hand: parallel_for and parallel_reduce are parallel loops whose
+ * leaves run sequential loops, sized by the grain controller, and
+ * which are split on promotion; fork2 is a spawn2_join.
+ *
+ * A function argument that takes a stack_type and a parent_link_type
+ * (and, for parallel_for, an index) and returns a stack_type is
+ * called as a DSL call, which allows for nested parallelism, as in:
+ *
+ *   stack_type fib(stack_type st, parent_link_type p, int n, int* dst) {
+ *     ...
+ *     return encore::fork2(st, p, [=] (stack_type st, parent_link_type p) {
+ *       return fib(st, p, n - 1, &d->d1);
+ *     }, [=] (stack_type st, parent_link_type p) {
+ *       return fib(st, p, n - 2, &d->d2);
+ *     });
+ *   }
+ *
+ * Any other function argument is called as a plain, sequential
+ * function.
+ */
+
+using stack_type = edsl::pcfg::stack_type;
+
+using parent_link_type = edsl::pcfg::cactus::parent_link_type;
+
+namespace lambda {
+
+// value is true if F can be called with arguments of types Args and
+// returns a stack_type, that is, if F is to be called as a DSL call
+template <class F, class ...Args>
+class is_dsl_call {
+private:
+
+  template <class G>
+  static
+  auto test(int) -> typename std::is_same<decltype(std::declval<G&>()(std::declval<Args>()...)), stack_type>::type;
+
+  template <class G>
+  static
+  std::false_type test(...);
+
+public:
+
+  static constexpr
+  bool value = decltype(test<F>(0))::value;
+
+};
+
+/*---------------------------------------------------------------------*/
+/* Sequential leaf */
+
+template <class Function>
+class call_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  Function f;
+
+  call_rec(Function f)
+  : f(f) { }
+
+  encore_dc_declare(encore::edsl, call_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmt([] (sar& s, par&) {
+      s.f();
+    });
+  }
+
+};
+
+template <class Function>
+typename call_rec<Function>::cfg_type call_rec<Function>::cfg = call_rec<Function>::get_cfg();
+
+template <class Function>
+stack_type call(stack_type st, parent_link_type p, Function& f, std::true_type) {
+  return f(st, p);
+}
+
+template <class Function>
+stack_type call(stack_type st, parent_link_type p, Function& f, std::false_type) {
+  return edsl::pcfg::push_call<call_rec<Function>>(st, p, f);
+}
+
+// calls f as a DSL call if it is one, or else pushes a call to f
+template <class Function>
+stack_type call(stack_type st, parent_link_type p, Function& f) {
+  using tag = std::integral_constant<bool, is_dsl_call<Function, stack_type, parent_link_type>::value>;
+  return call(st, p, f, tag());
+}
+
+/*---------------------------------------------------------------------*/
+/* Fork join */
+
+template <class Function1, class Function2>
+class fork2_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  Function1 f1;
+  Function2 f2;
+
+  fork2_rec(Function1 f1, Function2 f2)
+  : f1(f1), f2(f2) { }
+
+  encore_dc_declare(encore::edsl, fork2_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::spawn2_join([] (sar& s, par&, plt p, stt st) {
+      return call(st, p, s.f1);
+    }, [] (sar& s, par&, plt p, stt st) {
+      return call(st, p, s.f2);
+    });
+  }
+
+};
+
+template <class Function1, class Function2>
+typename fork2_rec<Function1,Function2>::cfg_type fork2_rec<Function1,Function2>::cfg = fork2_rec<Function1,Function2>::get_cfg();
+
+/*---------------------------------------------------------------------*/
+/* Parallel for */
+
+// body(i) is a sequential function
+template <class Body>
+class parallel_for_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  int lo; int hi;
+  Body body;
+
+  parallel_for_rec(int lo, int hi, Body body)
+  : lo(lo), hi(hi), body(body) { }
+
+  encore_private_activation_record_begin(encore::edsl, parallel_for_rec, 1)
+    int lo; int hi;
+  encore_private_activation_record_end(encore::edsl, parallel_for_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::parallel_for_loop([] (sar& s, par& p) {
+      p.lo = s.lo;
+      p.hi = s.hi;
+    }, [] (par& p) {
+      return std::make_pair(&p.lo, &p.hi);
+    }, [] (sar& s, par&, int lo, int hi) {
+      auto& body = s.body;
+      for (int i = lo; i < hi; i++) {
+        body(i);
+      }
+    });
+  }
+
+};
+
+template <class Body>
+typename parallel_for_rec<Body>::cfg_type parallel_for_rec<Body>::cfg = parallel_for_rec<Body>::get_cfg();
+
+// body(st, p, i) is a DSL call
+template <class Body>
+class parallel_for_call_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  int lo; int hi;
+  Body body;
+
+  parallel_for_call_rec(int lo, int hi, Body body)
+  : lo(lo), hi(hi), body(body) { }
+
+  encore_private_activation_record_begin(encore::edsl, parallel_for_call_rec, 1)
+    int lo; int hi;
+  encore_private_activation_record_end(encore::edsl, parallel_for_call_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::stmt([] (sar& s, par& p) {
+        p.lo = s.lo;
+        p.hi = s.hi;
+      }),
+      dc::parallel_for_loop([] (sar&, par& p) { return p.lo != p.hi; },
+                            [] (par& p) { return std::make_pair(&p.lo, &p.hi); },
+                            dc::stmts({
+        dc::spawn_join([] (sar& s, par& p, plt pt, stt st) {
+          return s.body(st, pt, p.lo);
+        }),
+        dc::stmt([] (sar&, par& p) {
+          p.lo++;
+        })
+      }))
+    });
+  }
+
+};
+
+template <class Body>
+typename parallel_for_call_rec<Body>::cfg_type parallel_for_call_rec<Body>::cfg = parallel_for_call_rec<Body>::get_cfg();
+
+/*---------------------------------------------------------------------*/
+/* Parallel reduce */
+
+template <class Item, class Combine, class Lift>
+class parallel_reduce_rec : public edsl::pcfg::shared_activation_record {
+public:
+
+  int lo; int hi;
+  Item identity; Combine combine; Lift lift;
+  Item* dest;
+
+  parallel_reduce_rec(int lo, int hi, Item identity, Combine combine, Lift lift, Item* dest)
+  : lo(lo), hi(hi), identity(identity), combine(combine), lift(lift), dest(dest) { }
+
+  class private_activation_record
+  : public edsl::pcfg::parallel_loop_private_activation_record<parallel_reduce_rec,
+  private_activation_record> {
+  public:
+
+    private_activation_record() {
+      private_activation_record::initialize_descriptors();
+    }
+
+    edsl::pcfg::parallel_combine_activation_record _ar;
+    edsl::pcfg::parallel_loop_activation_record* _encore_loop_activation_record_of(edsl::pcfg::parallel_loop_id_type) {
+      return &_ar;
+    }
+
+    int lo; int hi; Item acc;
+
+  };
+
+  encore_dc_loop_declare(encore::edsl, parallel_reduce_rec, sar, par, dc, get_dc)
+
+  static
+  dc get_dc() {
+    return dc::stmts({
+      dc::parallel_combine_loop([] (sar& s, par& p) {
+        p.lo = s.lo;
+        p.hi = s.hi;
+        p.acc = s.identity;
+      }, [] (par& p) {
+        return std::make_pair(&p.lo, &p.hi);
+      }, [] (sar& s, par& p) {
+        p.acc = s.identity;
+      }, [] (sar& s, par& p, par& dest) {
+        dest.acc = s.combine(p.acc, dest.acc);
+      }, [] (sar& s, par& p, int lo, int hi) {
+        auto& combine = s.combine;
+        auto& lift = s.lift;
+        Item acc = p.acc;
+        for (int i = lo; i < hi; i++) {
+          acc = combine(acc, lift(i));
+        }
+        p.acc = acc;
+      }),
+      dc::stmt([] (sar& s, par& p) {
+        *s.dest = p.acc;
+      })
+    });
+  }
+
+};
+
+template <class Item, class Combine, class Lift>
+typename parallel_reduce_rec<Item,Combine,Lift>::cfg_type parallel_reduce_rec<Item,Combine,Lift>::cfg = parallel_reduce_rec<Item,Combine,Lift>::get_cfg();
+
+} // end namespace
+
+/*---------------------------------------------------------------------*/
+/* Interface */
+
+// runs f1 and f2 in parallel
+template <class Function1, class Function2>
+stack_type fork2(stack_type st, parent_link_type p, Function1 f1, Function2 f2) {
+  return edsl::pcfg::push_call<lambda::fork2_rec<Function1,Function2>>(st, p, f1, f2);
+}
+
+template <class Function1, class Function2>
+stack_type fork2(stack_type st, Function1 f1, Function2 f2) {
+  return fork2(st, edsl::pcfg::cactus::Parent_link_sync, f1, f2);
+}
+
+// runs body(i), or body(st, p, i), for each i in [lo, hi)
+template <class Body>
+stack_type parallel_for(stack_type st, parent_link_type p, int lo, int hi, Body body) {
+  using rec = typename std::conditional<lambda::is_dsl_call<Body, stack_type, parent_link_type, int>::value,
+                                        lambda::parallel_for_call_rec<Body>,
+                                        lambda::parallel_for_rec<Body>>::type;
+  return edsl::pcfg::push_call<rec>(st, p, lo, hi, body);
+}
+
+template <class Body>
+stack_type parallel_for(stack_type st, int lo, int hi, Body body) {
+  return parallel_for(st, edsl::pcfg::cactus::Parent_link_sync, lo, hi, body);
+}
+
+// writes to dest the combination, by the associative operator combine
+// of identity element identity, of lift(i) for each i in [lo, hi)
+template <class Item, class Combine, class Lift>
+stack_type parallel_reduce(stack_type st, parent_link_type p, int lo, int hi,
+                           Item identity, Combine combine, Lift lift, Item* dest) {
+  using rec = lambda::parallel_reduce_rec<Item,Combine,Lift>;
+  return edsl::pcfg::push_call<rec>(st, p, lo, hi, identity, combine, lift, dest);
+}
+
+template <class Item, class Combine, class Lift>
+stack_type parallel_reduce(stack_type st, int lo, int hi,
+                           Item identity, Combine combine, Lift lift, Item* dest) {
+  return parallel_reduce(st, edsl::pcfg::cactus::Parent_link_sync, lo, hi, identity, combine, lift, dest);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_PARALLEL_H_ */
@@ -0,0 +1,387 @@
+#include <assert.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "fuel.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+#include "edsl.hpp"
+#include "parallel.hpp"
+#include "future.hpp"
+
+#ifndef _ENCORE_PIPELINE_H_
+#define _ENCORE_PIPELINE_H_
+
+namespace encore {
+namespace pipeline {
+
+/*---------------------------------------------------------------------*/
+/* Streaming pipelines
+ *
+ * A pipeline is a chain of stages that are connected by channels. A
+ * stage is a vertex that moves batches of items from its input channel
+ * to its output channel. Each channel holds at most a fixed number of
+ * batches, so that the memory used by a pipeline is bounded by the sum
+ * of the capacities of its channels, plus the one batch that each stage
+ * may be working on, no matter how fast each stage is.
+ *
+ * A stage whose input channel is empty, or whose output channel is
+ * full, waits (see vertex::wait): it registers itself with the channel,
+ * which schedules it again at the next push, or pop, respectively, so
+ * that a blocked stage costs nothing until it can make progress. Each
+ * channel is to have exactly one producer and one consumer stage. A
+ * stage of parallel_map runs its function over each batch by a
+ * parallel_for (see parallel.hpp), and is scheduled again once the
+ * parallel_for completes.
+ *
+ *   pipeline::channel<int> c1(4);
+ *   pipeline::channel<int> c2(4);
+ *   pipeline::source(c1, [&] (std::vector<int>& batch) { ... });
+ *   pipeline::parallel_map(c1, c2, [] (int x) { return x * x; });
+ *   auto done = pipeline::sink(c2, [&] (std::vector<int>& batch) { ... });
+ *
+ * Each of these functions creates and releases a stage, and returns a
+ * future that is set once the stage has completed. They are to be
+ * called by code that runs on a worker.
+ */
+
+template <class Item>
+class channel {
+public:
+
+  using batch_type = std::vector<Item>;
+
+  using pop_result_type = enum {
+    pop_success,
+    pop_empty,
+    pop_closed
+  };
+
+private:
+
+  std::mutex mutex;
+
+  std::deque<batch_type> batches;
+
+  int capacity;
+
+  bool closed = false;
+
+  int peak_nb_batches = 0;
+
+  // the stages that wait for the channel to be nonempty, or nonfull
+  sched::vertex* consumer = nullptr;
+  sched::vertex* producer = nullptr;
+
+  static
+  void wake(sched::vertex* v) {
+    if (v != nullptr) {
+      sched::schedule(v);
+    }
+  }
+
+public:
+
+  // capacity is the maximum number of batches held by the channel
+  channel(int capacity)
+  : capacity(std::max(1, capacity)) { }
+
+  // moves b into the channel, if the channel is not full
+  bool try_push(batch_type& b) {
+    sched::vertex* v;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      assert(! closed);
+      if ((int)batches.size() >= capacity) {
+        return false;
+      }
+      batches.push_back(std::move(b));
+      peak_nb_batches = std::max(peak_nb_batches, (int)batches.size());
+      v = consumer;
+      consumer = nullptr;
+    }
+    wake(v);
+    return true;
+  }
+
+  pop_result_type try_pop(batch_type& b) {
+    sched::vertex* v;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (batches.empty()) {
+        return closed ? pop_closed : pop_empty;
+      }
+      b = std::move(batches.front());
+      batches.pop_front();
+      v = producer;
+      producer = nullptr;
+    }
+    wake(v);
+    return pop_success;
+  }
+
+  // to be called by the producer after its last push
+  void close() {
+    sched::vertex* v;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      v = consumer;
+      consumer = nullptr;
+    }
+    wake(v);
+  }
+
+  // registers the consumer v to be scheduled once the channel is nonempty
+  // or closed; returns false if it is already
+  bool wait_for_pop(sched::vertex* v) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((! batches.empty()) || closed) {
+      return false;
+    }
+    assert(consumer == nullptr);
+    consumer = v;
+    return true;
+  }
+
+  // registers the producer v to be scheduled once the channel is nonfull;
+  // returns false if it is already
+  bool wait_for_push(sched::vertex* v) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((int)batches.size() < capacity) {
+      return false;
+    }
+    assert(producer == nullptr);
+    producer = v;
+    return true;
+  }
+
+  int get_capacity() const {
+    return capacity;
+  }
+
+  int get_peak_nb_batches() const {
+    return peak_nb_batches;
+  }
+
+};
+
+/*---------------------------------------------------------------------*/
+/* Stages */
+
+class stage_vertex : public sched::vertex {
+protected:
+
+  bool completed = false;
+
+  // the stage waits, once run() returns, by wait()
+  void request_wait() {
+    is_waiting = true;
+  }
+
+  void complete() {
+    completed = true;
+  }
+
+public:
+
+  int nb_strands() {
+    return completed ? 0 : 1;
+  }
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+template <class Item, class Generate>
+class source_vertex : public stage_vertex {
+private:
+
+  using batch_type = typename channel<Item>::batch_type;
+
+  channel<Item>& out;
+
+  Generate generate;
+
+  batch_type batch;
+
+  bool has_batch = false;
+
+public:
+
+  source_vertex(channel<Item>& out, const Generate& generate)
+  : out(out), generate(generate) { }
+
+  fuel::check_type run() {
+    while (true) {
+      if (! has_batch) {
+        batch.clear();
+        if (! generate(batch)) {
+          out.close();
+          complete();
+          break;
+        }
+        has_batch = true;
+      }
+      if (! out.try_push(batch)) {
+        request_wait();
+        break;
+      }
+      has_batch = false;
+    }
+    return fuel::check_no_promote;
+  }
+
+  bool wait() {
+    return out.wait_for_push(this);
+  }
+
+};
+
+template <class Input, class Output, class Function>
+class parallel_map_vertex : public stage_vertex {
+private:
+
+  using input_batch_type = typename channel<Input>::batch_type;
+  using output_batch_type = typename channel<Output>::batch_type;
+
+  channel<Input>& in;
+
+  channel<Output>& out;
+
+  Function f;
+
+  input_batch_type input;
+
+  output_batch_type output;
+
+  bool has_output = false;
+
+  // true if the stage waits for room in out, or else for a batch in in
+  bool waits_for_push = false;
+
+public:
+
+  parallel_map_vertex(channel<Input>& in, channel<Output>& out, const Function& f)
+  : in(in), out(out), f(f) { }
+
+  fuel::check_type run() {
+    while (true) {
+      if (has_output) {
+        if (! out.try_push(output)) {
+          waits_for_push = true;
+          request_wait();
+          break;
+        }
+        has_output = false;
+      }
+      auto r = in.try_pop(input);
+      if (r == channel<Input>::pop_closed) {
+        out.close();
+        complete();
+        break;
+      } else if (r == channel<Input>::pop_empty) {
+        waits_for_push = false;
+        request_wait();
+        break;
+      }
+      int n = (int)input.size();
+      output.resize(n);
+      input_batch_type* ip = &input;
+      output_batch_type* op = &output;
+      Function* fp = &f;
+      auto interp = new edsl::pcfg::interpreter;
+      interp->stack = encore::parallel_for(interp->stack, edsl::pcfg::cactus::Parent_link_sync, 0, n, [=] (int i) {
+        (*op)[i] = (*fp)((*ip)[i]);
+      });
+      has_output = true;
+      // this stage runs again once the parallel_for completes
+      sched::new_edge(interp, this);
+      sched::release(interp);
+      break;
+    }
+    return fuel::check_no_promote;
+  }
+
+  bool wait() {
+    return waits_for_push ? out.wait_for_push(this) : in.wait_for_pop(this);
+  }
+
+};
+
+template <class Item, class Consume>
+class sink_vertex : public stage_vertex {
+private:
+
+  using batch_type = typename channel<Item>::batch_type;
+
+  channel<Item>& in;
+
+  Consume consume;
+
+  batch_type batch;
+
+public:
+
+  sink_vertex(channel<Item>& in, const Consume& consume)
+  : in(in), consume(consume) { }
+
+  fuel::check_type run() {
+    while (true) {
+      auto r = in.try_pop(batch);
+      if (r == channel<Item>::pop_closed) {
+        complete();
+        break;
+      } else if (r == channel<Item>::pop_empty) {
+        request_wait();
+        break;
+      }
+      consume(batch);
+    }
+    return fuel::check_no_promote;
+  }
+
+  bool wait() {
+    return in.wait_for_pop(this);
+  }
+
+};
+
+template <class Stage>
+future<void> start(Stage* v) {
+  auto state = std::make_shared<futures::state_type<void>>();
+  state->control = v->get_outset()->make_chain_future();
+  sched::release(v);
+  return future<void>(state);
+}
+
+// generate(batch) appends the items of the next batch to batch, and
+// returns false if there are no more items
+template <class Item, class Generate>
+future<void> source(channel<Item>& out, const Generate& generate) {
+  return start(new source_vertex<Item, Generate>(out, generate));
+}
+
+// f(x) returns the output item of the input item x; f is applied to
+// the items of each batch in parallel, and batches are output in order
+template <class Input, class Output, class Function>
+future<void> parallel_map(channel<Input>& in, channel<Output>& out, const Function& f) {
+  return start(new parallel_map_vertex<Input, Output, Function>(in, out, f));
+}
+
+// consume(batch) is called on each batch, in order
+template <class Item, class Consume>
+future<void> sink(channel<Item>& in, const Consume& consume) {
+  return start(new sink_vertex<Item, Consume>(in, consume));
+}
+
+} // end namespace
+} // end namespace
+
+#endif /*! _ENCORE_PIPELINE_H_ */
@@ -0,0 +1,355 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include "perworker.hpp"
+#include "cmdline.hpp"
+#include "machine.hpp"
+#include "dagfile.hpp"
+
+#ifndef _ENCORE_PROFILE_H_
+#define _ENCORE_PROFILE_H_
+
+namespace encore {
+
+/*---------------------------------------------------------------------*/
+/* Work and span profiler
+ *
+ * Work is the sum of the cycles spent in the basic blocks of all
+ * strands. Span is the length in cycles of the longest path in the
+ * dag: each vertex carries the length of the longest path that leads
+ * to its current program point. A vertex starts its life at the span of
+ * the vertex that created it, adds the cycles of each block it runs,
+ * and is pushed forward by the spans of its predecessors as their
+ * edges are satisfied (i.e., as its incounter is decremented).
+ *
+ * The burdened span additionally charges a fixed cost to each
+ * promotion, to account for the overheads of creating and migrating
+ * vertices.
+ *
+ * When -dag_record <file> is given, the profiler also records the
+ * dynamic computation DAG (see dagfile.hpp). The work of each vertex is
+ * cut into nodes at each promotion, and each time the vertex resumes
+ * after it received dependency edges. The recorded edges are those from
+ * a node to its continuation in the same vertex, from a promoting node
+ * to the first node of each new vertex, and dependency edges, from the
+ * last node of a vertex that completes to the node at which each of
+ * its successors resumes. Releases of fresh vertices are not dependency
+ * edges, as promotions record them already.
+ */
+
+template <bool enabled>
+class profile_base {
+public:
+
+  class span_record {
+  public:
+
+    uint64_t length = 0;
+
+    uint64_t burdened_length = 0;
+
+    std::atomic<uint64_t> length_of_predecessors;
+
+    std::atomic<uint64_t> burdened_length_of_predecessors;
+
+    // current node of the vertex in the recorded dag, or zero if none yet
+    uint64_t dag_node = 0;
+
+    // work of the current node
+    uint64_t dag_work = 0;
+
+    // node that was ended by the last promotion, as long as the current
+    // node, which continues it, has done nothing yet; zero otherwise
+    uint64_t dag_sealed = 0;
+
+    // node at which the vertex resumes after the dependency edges that it
+    // received, or zero if none; set by the sources of these edges
+    std::atomic<uint64_t> dag_next_node;
+
+    span_record()
+    : length_of_predecessors(0), burdened_length_of_predecessors(0), dag_next_node(0) { }
+
+    ~span_record() {
+      on_destroy(*this);
+    }
+
+  };
+
+  using measurement_type = struct {
+    uint64_t work;
+    uint64_t span;
+    uint64_t burdened_span;
+  };
+
+private:
+
+  // read by measure() while the workers add to their own cells
+  static
+  data::perworker::array<std::atomic<uint64_t>> all_work;
+
+  static
+  uint64_t burden;
+
+  static
+  void write_max(std::atomic<uint64_t>& cell, uint64_t x) {
+    uint64_t orig = cell.load();
+    while ((orig < x) && (! cell.compare_exchange_weak(orig, x)));
+  }
+
+  static
+  bool recording;
+
+  static
+  std::atomic<uint64_t> dag_next_id;
+
+  static
+  data::perworker::array<std::vector<dagfile::node_type>> dag_nodes;
+
+  static
+  data::perworker::array<std::vector<dagfile::edge_type>> dag_edges;
+
+  static
+  uint64_t node_of(span_record& s) {
+    if (s.dag_node == 0) {
+      s.dag_node = dag_next_id++;
+    }
+    return s.dag_node;
+  }
+
+  static
+  void add_edge(uint64_t src, uint64_t dst) {
+    dagfile::edge_type e;
+    e.src = src;
+    e.dst = dst;
+    dag_edges.mine().push_back(e);
+  }
+
+  // returns the node at which s is to resume, allocating it if need be
+  static
+  uint64_t next_node_of(span_record& s) {
+    uint64_t n = s.dag_next_node.load();
+    if (n != 0) {
+      return n;
+    }
+    uint64_t m = dag_next_id++;
+    if (s.dag_next_node.compare_exchange_strong(n, m)) {
+      return m;
+    }
+    return n;
+  }
+
+  static
+  void flush_node(span_record& s) {
+    dagfile::node_type n;
+    n.id = node_of(s);
+    n.work = s.dag_work;
+    // nodes without work are kept, as edges may lead to, or from, them
+    dag_nodes.mine().push_back(n);
+    s.dag_work = 0;
+  }
+
+  // ends the current node of s, which continues in a fresh node, and
+  // returns the identifier of the node that was ended; the promotions
+  // that create several vertices at once end the node only once
+  static
+  uint64_t seal(span_record& s) {
+    if (s.dag_sealed != 0) {
+      return s.dag_sealed;
+    }
+    uint64_t n = node_of(s);
+    flush_node(s);
+    s.dag_node = dag_next_id++;
+    add_edge(n, s.dag_node);
+    s.dag_sealed = n;
+    return n;
+  }
+
+  static
+  void on_destroy(span_record& s) {
+    if ((! enabled) || (! recording)) {
+      return;
+    }
+    if ((s.dag_node != 0) || (s.dag_work != 0)) {
+      flush_node(s);
+    }
+  }
+
+public:
+
+  static
+  void initialize() {
+    if (! enabled) {
+      return;
+    }
+    burden = (uint64_t)deepsea::cmdline::parse_or_default("profile_burden_cycles", 15000);
+    all_work.for_each([&] (int, std::atomic<uint64_t>& w) {
+      w.store(0);
+    });
+    recording = (deepsea::cmdline::parse_or_default_string("dag_record", "") != "");
+    dag_next_id.store(1);
+    dag_nodes.for_each([&] (int, std::vector<dagfile::node_type>& ns) {
+      ns.clear();
+    });
+    dag_edges.for_each([&] (int, std::vector<dagfile::edge_type>& es) {
+      es.clear();
+    });
+  }
+
+  // to be called each time a strand completes the execution of a block
+  static inline
+  void on_block(span_record& s, uint64_t elapsed) {
+    if (! enabled) {
+      return;
+    }
+    std::atomic<uint64_t>& w = all_work.mine();
+    w.store(w.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    s.length += elapsed;
+    s.burdened_length += elapsed;
+    s.dag_work += elapsed;
+    s.dag_sealed = 0;
+  }
+
+  // to be called when a vertex is about to run
+  static inline
+  void on_enter_vertex(span_record& s) {
+    if (! enabled) {
+      return;
+    }
+    s.length = std::max(s.length, s.length_of_predecessors.load());
+    s.burdened_length = std::max(s.burdened_length, s.burdened_length_of_predecessors.load());
+    if (recording) {
+      uint64_t n = s.dag_next_node.exchange(0);
+      if (n == 0) {
+        return;
+      }
+      if (s.dag_node != 0) {
+        flush_node(s);
+        add_edge(s.dag_node, n);
+      }
+      s.dag_node = n;
+      s.dag_sealed = 0;
+    }
+  }
+
+  // to be called by source, a vertex that completes, before the edge to
+  // its successor destination is satisfied
+  static inline
+  void on_edge(span_record& source, span_record& destination) {
+    if (! enabled) {
+      return;
+    }
+    write_max(destination.length_of_predecessors, source.length);
+    write_max(destination.burdened_length_of_predecessors, source.burdened_length);
+    if (recording) {
+      add_edge(node_of(source), next_node_of(destination));
+    }
+  }
+
+  // to be called when parent promotes some of its latent parallelism
+  // into the new vertex child
+  static inline
+  void on_promotion(span_record& parent, span_record& child) {
+    if (! enabled) {
+      return;
+    }
+    child.length = parent.length;
+    child.burdened_length = parent.burdened_length + burden;
+    if (recording) {
+      add_edge(seal(parent), node_of(child));
+    }
+  }
+
+  static
+  uint64_t get_work() {
+    uint64_t w = 0;
+    all_work.for_each([&] (int, std::atomic<uint64_t>& w_i) {
+      w += w_i.load(std::memory_order_relaxed);
+    });
+    return w;
+  }
+
+  static
+  measurement_type measure(const span_record& s) {
+    measurement_type m;
+    m.work = get_work();
+    m.span = s.length;
+    m.burdened_span = s.burdened_length;
+    return m;
+  }
+
+  static
+  measurement_type since(measurement_type start, const span_record& s) {
+    measurement_type m = measure(s);
+    m.work -= start.work;
+    m.span -= start.span;
+    m.burdened_span -= start.burdened_span;
+    return m;
+  }
+
+  // writes the recorded dag; to be called after all vertices are gone
+  static
+  void output_dag() {
+    if ((! enabled) || (! recording)) {
+      return;
+    }
+    std::string fname = deepsea::cmdline::parse_or_default_string("dag_record", "");
+    FILE* f = fopen(fname.c_str(), "w");
+    if (f == nullptr) {
+      atomic::die("failed to open %s\n", fname.c_str());
+    }
+    dagfile::header_type h;
+    h.magic = dagfile::magic;
+    h.nb_ids = dag_next_id.load();
+    h.nb_nodes = 0;
+    h.nb_edges = 0;
+    h.cpu_frequency_ghz = machine::cpu_frequency_ghz;
+    h.nb_workers = data::perworker::get_nb_workers();
+    dag_nodes.for_each([&] (int, std::vector<dagfile::node_type>& ns) {
+      h.nb_nodes += ns.size();
+    });
+    dag_edges.for_each([&] (int, std::vector<dagfile::edge_type>& es) {
+      h.nb_edges += es.size();
+    });
+    fwrite(&h, sizeof(h), 1, f);
+    dag_nodes.for_each([&] (int, std::vector<dagfile::node_type>& ns) {
+      fwrite(ns.data(), sizeof(dagfile::node_type), ns.size(), f);
+    });
+    dag_edges.for_each([&] (int, std::vector<dagfile::edge_type>& es) {
+      fwrite(es.data(), sizeof(dagfile::edge_type), es.size(), f);
+    });
+    fclose(f);
+  }
+
+};
+
+template <bool enabled>
+data::perworker::array<std::atomic<uint64_t>> profile_base<enabled>::all_work;
+
+template <bool enabled>
+uint64_t profile_base<enabled>::burden = 0;
+
+template <bool enabled>
+bool profile_base<enabled>::recording = false;
+
+template <bool enabled>
+std::atomic<uint64_t> profile_base<enabled>::dag_next_id(1);
+
+template <bool enabled>
+data::perworker::array<std::vector<dagfile::node_type>> profile_base<enabled>::dag_nodes;
+
+template <bool enabled>
+data::perworker::array<std::vector<dagfile::edge_type>> profile_base<enabled>::dag_edges;
+
+#ifdef ENCORE_ENABLE_PROFILING
+using profile = profile_base<true>;
+#else
+using profile = profile_base<false>;
+#endif
+
+} // end namespace
+
+#endif /*! _ENCORE_PROFILE_H_ */
@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include "fuel.hpp"
+#include "incounter.hpp"
+#include "vertex.hpp"
+#include "scheduler.hpp"
+#include "future.hpp"
+
+#ifndef _ENCORE_ROUNDS_H_
+#define _ENCORE_ROUNDS_H_
+
+namespace encore {
+namespace rounds {
+
+/*---------------------------------------------------------------------*/
+/* Reusable barrier
+ *
+ * A barrier synchronizes a fixed set of participants over a sequence of
+ * episodes. Each participant enters episode e, by enter(), before it
+ * arrives at episode e - 1, and the arrivals of an episode are counted
+ * by a SNZI tree, whose leaves spread the participants, so that no
+ * single cache line is contended. The arrival that brings the tree to
+ * zero is the last one of its episode. Two trees are used in turn, one
+ * for the even and one for the odd episodes, so that the entries for
+ * episode e + 1 do not mix with the arrivals at episode e.
+ *
+ * Participants that arrive before the last one wait (see vertex::wait)
+ * by wait(), and are scheduled by the last one, by complete().
+ */
+
+static constexpr
+int barrier_tree_height = 6;
+
+class barrier {
+public:
+
+  using tree_type = sched::gsnzi::tree<barrier_tree_height>;
+
+  using node_type = typename tree_type::node_type;
+
+private:
+
+  tree_type trees[2];
+
+  std::mutex mutex;
+
+  int nb_completed_episodes = 0;
+
+  std::vector<sched::vertex*> waiters;
+
+public:
+
+  // returns the node by which participant id is to arrive at episode
+  node_type* enter(int id, int episode) {
+    node_type* n = trees[episode % 2].get_target_of_path((unsigned)id);
+    n->increment();
+    return n;
+  }
+
+  // returns true if the caller is the last participant of its episode
+  bool arrive(node_type* n) {
+    return n->decrement();
+  }
+
+  // registers v to be scheduled once episode completes; returns false
+  // if it has completed already
+  bool wait(sched::vertex* v, int episode) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (nb_completed_episodes > episode) {
+      return false;
+    }
+    waiters.push_back(v);
+    return true;
+  }
+
+  // to be called by the last participant of episode; schedules the
+  // participants that wait for it
+  void complete(int episode) {
+    std::vector<sched::vertex*> vs;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      assert(nb_completed_episodes == episode);
+      nb_completed_episodes = episode + 1;
+      vs.swap(waiters);
+    }
+    for (auto v : vs) {
+      sched::schedule(v);
+    }
+  }
+
+};
+
+/*---------------------------------------------------------------------*/
+/* Parallel rounds
+ *
+ * parallel_rounds(n, body, next) runs body(round, lo, hi) over [0, n),
+ * for round = 0, 1, ..., until next(round), which is called once all
+ * of round is done, returns false. The range is cut into a fixed set of
+ * chunks, each of which is run by a vertex that lives across rounds:
+ * round transitions cost a barrier episode, rather than the join of a
+ * parallel_for and the promotions that ramp up the next one. next()
+ * runs sequentially, between two rounds, and is the place for the work
+ * that a round loop does between parallel_fors, e.g., swapping the
+ * frontiers of a BFS.
+ *
+ *   auto r = encore::parallel_rounds(n, [&] (int round, int lo, int hi) {
+ *     for (int i = lo; i < hi; i++) { ... }
+ *   }, [&] (int round) {
+ *     return ! frontier_is_empty();
+ *   });
+ *
+ * The result is a future for the number of rounds, which DSL code may
+ * wait for by passing r.get_future() to dc::join_minus. The body is to
+ * balance its own work across the range, as the chunks are not split.
+ */
+
+// number of chunks per worker, by default
+int chunks_per_worker = 2;
+
+template <class Body, class Next>
+class shared_state {
+public:
+
+  Body body;
+
+  Next next;
+
+  barrier b;
+
+  // the value returned by next at the last completed round
+  bool more = true;
+
+  int nb_rounds = 0;
+
+  shared_state(const Body& body, const Next& next)
+  : body(body), next(next) { }
+
+};
+
+template <class Body, class Next>
+class chunk_vertex : public sched::vertex {
+private:
+
+  std::shared_ptr<shared_state<Body, Next>> state;
+
+  int id;
+
+  int lo; int hi;
+
+  int round = 0;
+
+  barrier::node_type* node;
+
+  bool completed = false;
+
+public:
+
+  chunk_vertex(std::shared_ptr<shared_state<Body, Next>> state, int id, int lo, int hi)
+  : state(state), id(id), lo(lo), hi(hi) {
+    node = state->b.enter(id, 0);
+  }
+
+  int nb_strands() {
+    return completed ? 0 : 1;
+  }
+
+  fuel::check_type run() {
+    auto& s = *state;
+    if ((round > 0) && (! s.more)) {
+      completed = true;
+      return fuel::check_no_promote;
+    }
+    while (true) {
+      s.body(round, lo, hi);
+      barrier::node_type* next_node = s.b.enter(id, round + 1);
+      if (! s.b.arrive(node)) {
+        node = next_node;
+        round++;
+        is_waiting = true;
+        break;
+      }
+      // the last chunk to complete the round runs the transition
+      s.more = s.next(round);
+      s.nb_rounds = round + 1;
+      s.b.complete(round);
+      node = next_node;
+      round++;
+      if (! s.more) {
+        completed = true;
+        break;
+      }
+    }
+    return fuel::check_no_promote;
+  }
+
+  bool wait() {
+    return state->b.wait(this, round - 1);
+  }
+
+  sched::vertex_split_type split(int) {
+    assert(false); // impossible
+    return sched::make_vertex_split(nullptr, nullptr);
+  }
+
+};
+
+} // end namespace
+
+// runs body(round, lo, hi) over chunks of [0, n), round after round, as
+// long as next(round) returns true; nb_chunks is the number of chunks,
+// or zero for rounds::chunks_per_worker per worker
+template <class Body, class Next>
+future<int> parallel_rounds(int n, const Body& body, const Next& next, int nb_chunks = 0) {
+  if (nb_chunks <= 0) {
+    nb_chunks = rounds::chunks_per_worker * data::perworker::get_nb_workers();
+  }
+  nb_chunks = std::max(1, std::min(nb_chunks, n));
+  auto state = std::make_shared<rounds::shared_state<Body, Next>>(body, next);
+  auto result = std::make_shared<futures::state_type<int>>();
+  auto f = [state] {
+    return state->nb_rounds;
+  };
+  auto join = new futures::compute_vertex<int, decltype(f)>(result, f);
+  result->control = join->get_outset()->make_chain_future();
+  std::vector<sched::vertex*> chunks;
+  for (int i = 0; i < nb_chunks; i++) {
+    int lo = (int)(((long)n * i) / nb_chunks);
+    int hi = (int)(((long)n * (i + 1)) / nb_chunks);
+    auto v = new rounds::chunk_vertex<Body, Next>(state, i, lo, hi);
+    v->get_outset()->make_unary();
+    sched::new_edge(v, join);
+    chunks.push_back(v);
+  }
+  for (auto v : chunks) {
+    sched::release(v);
+  }
+  sched::release(join);
+  return future<int>(result);
+}
+
+} // end namespace
+
+#endif /*! _ENCORE_ROUNDS_H_ */
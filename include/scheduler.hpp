@@ -7,8 +7,12 @@
 #include "perworker.hpp"
 #include "chunkedseq.hpp"
 #include "logging.hpp"
+#include "machine.hpp"
 #include "stats.hpp"
+#include "metrics.hpp"
+#include "elastic.hpp"
 #include "chaselev.hpp"
+#include "iouring.hpp"
 
 #ifndef _ENCORE_SCHEDULER_H_
 #define _ENCORE_SCHEDULER_H_
@@ -34,11 +38,43 @@ using perworker_array = data::perworker::array<Item>;
   
 perworker_array<vertex*> vertices;
   
-perworker_array<std::deque<vertex*>> suspended;
-  
+// my_vertex() is the vertex that the calling worker is running, and is
+// valid only from within the run() of that vertex, as the vertex may be
+// scheduled elsewhere, or deallocated, once run() returns
 fuel::check_type run_vertex(vertex* v) {
-  vertices.mine() = v;
-  return v->run();
+  vertex*& current = vertices.mine();
+  current = v;
+#ifdef ENCORE_ENABLE_PROFILING
+  profile::on_enter_vertex(v->span);
+#endif
+  auto f = v->run();
+  current = nullptr;
+  return f;
+}
+  
+// to be called on a vertex that has no strands left: notifies the
+// successors of the vertex and then deallocates the vertex
+void finish_vertex(vertex* v) {
+#ifdef ENCORE_ENABLE_PROFILING
+  profile::on_enter_vertex(v->span);
+#endif
+  parallel_notify(v->get_outset(), v);
+  delete v;
+}
+
+// to be called once run_vertex(v) has returned: finishes v, if v has
+// no strands left, or else registers the wakeup that v requested by
+// setting is_waiting, if any
+void settle_vertex(vertex* v) {
+  if (v->nb_strands() == 0) {
+    finish_vertex(v);
+  } else if (v->is_waiting) {
+    v->is_waiting = false;
+    stats::on_wait();
+    if (! v->wait()) {
+      schedule(v);
+    }
+  }
 }
   
 bool should_exit = false;
@@ -78,8 +114,9 @@ void worker_loop(vertex* v) {
   int my_id = data::perworker::get_my_id();
   chase_lev_deque& my_ready = *deques[my_id];
   std::deque<vertex*>& my_buffer = buffer[my_id];
-  std::deque<vertex*>& my_suspended = suspended[my_id];
+  machine::initialize_worker(my_id);
   fuel::initialize_worker();
+  stats::on_enter_worker();
   
   if (v != nullptr) {
     // this worker is the leader
@@ -102,10 +139,11 @@ void worker_loop(vertex* v) {
         
   // called by workers when running out of work
   auto acquire = [&] {
-    assert(my_ready.empty() && my_suspended.empty() && my_buffer.empty());
+    assert(my_ready.empty() && my_buffer.empty());
     assert(data::perworker::get_nb_workers() >= 2);
     logging::push_event(logging::enter_wait);
     while (! is_finished()) {
+      machine::relax();
       int k = random_other_worker(my_id);
       chase_lev_deque& deque_k = *deques[k];
       vertex* v = deque_k.pop_front();
@@ -126,12 +164,7 @@ void worker_loop(vertex* v) {
   };
 
   auto unblock = [&] {
-    if (my_suspended.empty()) {
-      return;
-    }
-    vertex* v = my_suspended.front();
-    my_suspended.pop_front();
-    run_vertex(v);
+    io::poll();
   };
   
   auto run = [&] {
@@ -142,10 +175,7 @@ void worker_loop(vertex* v) {
         break;
       }
       f = run_vertex(v);
-      if (v->nb_strands() == 0) {
-        parallel_notify(v->get_outset());
-        delete v;
-      }
+      settle_vertex(v);
     }
     return f;
   };
@@ -153,8 +183,11 @@ void worker_loop(vertex* v) {
   flush();
 
   while (! is_finished()) {
+    metrics::publisher::on_scheduler_loop(my_ready.nb_threads() + my_buffer.size(), io::nb_pending.mine().load());
     if (! my_ready.empty()) {
       run();
+    } else if (io::has_pending()) {
+      unblock();
     } else if (data::perworker::get_nb_workers() == 1) {
       break;
     } else {
@@ -162,11 +195,12 @@ void worker_loop(vertex* v) {
       acquire();
       stats::on_exit_acquire(s);
     }
-    flush();
     unblock();
+    flush();
   }
   
-  assert(my_ready.empty() && my_buffer.empty() && my_suspended.empty());
+  assert(my_ready.empty() && my_buffer.empty());
+  stats::on_exit_worker();
   nb_running_workers--;
 }
   
@@ -193,7 +227,9 @@ void launch(int nb_workers, vertex* v) {
   }
   logging::push_event(logging::enter_algo);
   worker_loop(v);
-  while (nb_running_workers.load() > 0);
+  while (nb_running_workers.load() > 0) {
+    machine::relax();
+  }
   logging::push_event(logging::exit_algo);
   for (auto i = 0; i < nb_workers; i++) {
     cls[i].destroy();
@@ -218,9 +254,10 @@ perworker_array<std::atomic<vertex*>> transfer;
 void worker_loop(vertex* v) {
   int my_id = data::perworker::get_my_id();
   std::deque<vertex*>& my_ready = deques[my_id];
-  std::deque<vertex*>& my_suspended = suspended[my_id];
   std::atomic<vertex*>& my_transfer = transfer[my_id];
+  machine::initialize_worker(my_id);
   fuel::initialize_worker();
+  stats::on_enter_worker();
   
   if (v != nullptr) {
     // this worker is the leader
@@ -248,9 +285,10 @@ void worker_loop(vertex* v) {
     if (data::perworker::get_nb_workers() == 1) {
       return;
     }
-    assert(my_ready.empty() && my_suspended.empty() && (my_transfer.load() == nullptr));
+    assert(my_ready.empty() && (my_transfer.load() == nullptr));
     logging::push_event(logging::enter_wait);
     while (! is_finished()) {
+      machine::relax();
       int k = random_other_worker(my_id);
       vertex* orig = transfer[k].load();
       if (orig == nullptr) {
@@ -269,12 +307,7 @@ void worker_loop(vertex* v) {
   };
 
   auto unblock = [&] {
-    if (my_suspended.empty()) {
-      return;
-    }
-    vertex* v = my_suspended.front();
-    my_suspended.pop_front();
-    run_vertex(v);
+    io::poll();
   };
   
   auto run = [&] {
@@ -283,10 +316,7 @@ void worker_loop(vertex* v) {
       vertex* v = my_ready.back();
       my_ready.pop_back();
       f = run_vertex(v);
-      if (v->nb_strands() == 0) {
-        parallel_notify(v->get_outset());
-        delete v;
-      }
+      settle_vertex(v);
     }
 #ifdef ENCORE_RANDOMIZE_SCHEDULE
     auto N = (int)my_ready.size();
@@ -304,12 +334,15 @@ void worker_loop(vertex* v) {
 
   vertex* tmp;
   while (! is_finished()) {
+    metrics::publisher::on_scheduler_loop(my_ready.size(), io::nb_pending.mine().load());
     if (! my_ready.empty()) {
       run();
     } else if ((tmp = my_transfer.load()) != nullptr) {
       if (atomic::compare_exchange(my_transfer, tmp, (vertex*)nullptr)) {
         my_ready.push_back(tmp);
       }
+    } else if (io::has_pending()) {
+      unblock();
     } else if (data::perworker::get_nb_workers() == 1) {
       break;
     } else {
@@ -322,7 +355,7 @@ void worker_loop(vertex* v) {
   }
   
   assert(my_ready.empty());
-  assert(my_suspended.empty());
+  stats::on_exit_worker();
   nb_running_workers--;
 }
   
@@ -339,7 +372,9 @@ void launch(int nb_workers, vertex* v) {
   }
   logging::push_event(logging::enter_algo);
   worker_loop(v);
-  while (nb_running_workers.load() > 0);
+  while (nb_running_workers.load() > 0) {
+    machine::relax();
+  }
   logging::push_event(logging::exit_algo);
 }
   
@@ -369,8 +404,9 @@ perworker_array<std::atomic<vertex*>> transfer;
 void worker_loop(vertex* v) {
   int my_id = data::perworker::get_my_id();
   std::deque<vertex*>& my_ready = deques[my_id];
-  std::deque<vertex*>& my_suspended = suspended[my_id];
+  machine::initialize_worker(my_id);
   fuel::initialize_worker();
+  stats::on_enter_worker();
   
   if (v != nullptr) {
     // this worker is the leader
@@ -418,14 +454,16 @@ void worker_loop(vertex* v) {
     if (data::perworker::get_nb_workers() == 1) {
       return;
     }
-    assert(my_ready.empty() && my_suspended.empty());
+    assert(my_ready.empty());
     logging::push_event(logging::enter_wait);
     while (! is_finished()) {
+      machine::relax();
       transfer[my_id].store(no_response);
       int k = random_other_worker(my_id);
       int orig = no_request;
       if (status[k].load() && atomic::compare_exchange(request[k], orig, my_id)) {
         while (transfer[my_id].load() == no_response) {
+          machine::relax();
           if (is_finished()) {
             logging::push_event(logging::exit_wait);
             return;
@@ -448,12 +486,7 @@ void worker_loop(vertex* v) {
   };
 
   auto unblock = [&] {
-    if (my_suspended.empty()) {
-      return;
-    }
-    vertex* v = my_suspended.front();
-    my_suspended.pop_front();
-    run_vertex(v);
+    io::poll();
   };
   
   auto run = [&] {
@@ -462,10 +495,7 @@ void worker_loop(vertex* v) {
       vertex* v = my_ready.back();
       my_ready.pop_back();
       f = run_vertex(v);
-      if (v->nb_strands() == 0) {
-        parallel_notify(v->get_outset());
-        delete v;
-      }
+      settle_vertex(v);
     }
 #ifdef ENCORE_RANDOMIZE_SCHEDULE
     auto N = (int)my_ready.size();
@@ -482,12 +512,13 @@ void worker_loop(vertex* v) {
   };
   
   while (! is_finished()) {
+    metrics::publisher::on_scheduler_loop(my_ready.size(), io::nb_pending.mine().load());
     if (! my_ready.empty()) {
       communicate();
       run();
       unblock();
       update_status();
-    } else if (my_suspended.size() >= 1) {
+    } else if (io::has_pending()) {
       communicate();
       unblock();
     } else if (data::perworker::get_nb_workers() == 1) {
@@ -501,7 +532,7 @@ void worker_loop(vertex* v) {
   }
   
   assert(my_ready.empty());
-  assert(my_suspended.empty());
+  stats::on_exit_worker();
   nb_running_workers--;
 }
   
@@ -524,7 +555,9 @@ void launch(int nb_workers, vertex* v) {
   }
   logging::push_event(logging::enter_algo);
   worker_loop(v);
-  while (nb_running_workers.load() > 0);
+  while (nb_running_workers.load() > 0) {
+    machine::relax();
+  }
   logging::push_event(logging::exit_algo);
 }
   
@@ -593,14 +626,12 @@ public:
     while ((f == fuel::check_no_promote) && (! empty())) {
       vertex* v = pop();
       f = run_vertex(v);
-      if (v->nb_strands() == 0) {
-        parallel_notify(v->get_outset());
-        delete v;
-      }
+      settle_vertex(v);
     }
   }
   
   void split(int nb, frontier& other) {
+    auto s = stats::on_enter_split();
     vertex* v = nullptr;
     vs.split([&] (int n) { return nb < n; }, v, other.vs);
     int vnb = v->nb_strands();
@@ -618,6 +649,7 @@ public:
       vs.push_front(sr.v1);
       other.vs.push_back(sr.v2);
     }
+    stats::on_exit_split(s);
 #if defined(ENCORE_ENABLE_LOGGING)
     int n2 = nb_strands();
     int n3 = other.nb_strands();
@@ -636,6 +668,10 @@ std::atomic<int> nb_running_workers;
 perworker_array<std::atomic<bool>> status;
 
 static constexpr int no_request = -1;
+
+// held by the request cell of a retired worker, so that no thief waits
+// for it to respond
+static constexpr int retired_request = -2;
   
 perworker_array<std::atomic<int>> request;
   
@@ -650,8 +686,10 @@ perworker_array<frontier> frontiers;
 void worker_loop(vertex* v) {
   int my_id = data::perworker::get_my_id();
   frontier& my_ready = frontiers[my_id];
-  std::deque<vertex*>& my_suspended = suspended[my_id];
+  machine::initialize_worker(my_id);
   fuel::initialize_worker();
+  stats::on_enter_worker();
+  elastic::on_enter_worker();
   
   if (v != nullptr) {
     // this worker is the leader
@@ -663,9 +701,10 @@ void worker_loop(vertex* v) {
     return should_exit && my_ready.empty();
   };
     
-  // update the status flag
+  // update the status flag; a retiring worker gives away even its
+  // last strand
   auto update_status = [&] {
-    bool b = (my_ready.nb_strands() >= 2);
+    bool b = (my_ready.nb_strands() >= (elastic::is_retiring() ? 1 : 2));
     if (status[my_id].load() != b) {
       status[my_id].store(b);
     }
@@ -679,7 +718,12 @@ void worker_loop(vertex* v) {
       return;
     }
     int sz = my_ready.nb_strands();
-    if (sz > 1) {
+    if ((sz >= 1) && elastic::is_retiring()) {
+      // transfer the whole local frontier to worker with id j
+      frontier* f = new frontier;
+      f->swap(my_ready);
+      transfer[j].store(f);
+    } else if (sz > 1) {
       // transfer half of the local frontier to worker with id j
       frontier* f = new frontier;
       my_ready.split(sz / 2, *f);
@@ -695,14 +739,16 @@ void worker_loop(vertex* v) {
     if (data::perworker::get_nb_workers() == 1) {
       return;
     }
-    assert(my_ready.empty() && my_suspended.empty());
+    assert(my_ready.empty());
     logging::push_event(logging::enter_wait);
-    while (! is_finished()) {
+    while ((! is_finished()) && (! elastic::should_retire())) {
+      machine::relax();
       transfer[my_id].store(no_response);
       int k = random_other_worker(my_id);
       int orig = no_request;
       if (status[k].load() && atomic::compare_exchange(request[k], orig, my_id)) {
         while (transfer[my_id].load() == no_response) {
+          machine::relax();
           if (is_finished()) {
             logging::push_event(logging::exit_wait);
             return;
@@ -726,25 +772,36 @@ void worker_loop(vertex* v) {
   };
   
   auto unblock = [&] {
-    if (my_suspended.empty()) {
-      return;
+    io::poll();
+  };
+  
+  // called by a retiring worker once it holds no more work
+  auto retire = [&] {
+    status[my_id].store(false);
+    int orig = no_request;
+    while (! atomic::compare_exchange(request[my_id], orig, retired_request)) {
+      communicate();
+      orig = no_request;
     }
-    vertex* v = my_suspended.front();
-    my_suspended.pop_front();
-    run_vertex(v);
+    elastic::park([&] { return should_exit; });
+    request[my_id].store(no_request);
   };
   
   while (! is_finished()) {
+    metrics::publisher::on_scheduler_loop(my_ready.nb_strands(), io::nb_pending.mine().load());
+    bool retiring = elastic::should_retire();
     if (my_ready.nb_strands() >= 1) {
       communicate();
       my_ready.run();
       unblock();
       update_status();
-    } else if (my_suspended.size() >= 1) {
+    } else if (io::has_pending()) {
       communicate();
       unblock();
     } else if (data::perworker::get_nb_workers() == 1) {
       break;
+    } else if (retiring) {
+      retire();
     } else {
       auto s = stats::on_enter_acquire();
       acquire();
@@ -754,7 +811,7 @@ void worker_loop(vertex* v) {
   }
 
   assert(my_ready.empty());
-  assert(my_suspended.empty());
+  stats::on_exit_worker();
   nb_running_workers--;
 }
   
@@ -777,7 +834,9 @@ void launch(int nb_workers, vertex* v) {
   }
   logging::push_event(logging::enter_algo);
   worker_loop(v);
-  while (nb_running_workers.load() > 0);
+  while (nb_running_workers.load() > 0) {
+    machine::relax();
+  }
   logging::push_event(logging::exit_algo);
 }
 
@@ -846,14 +905,12 @@ public:
     while ((f == fuel::check_no_promote) && (! empty())) {
       vertex* v = pop();
       f = run_vertex(v);
-      if (v->nb_strands() == 0) {
-        parallel_notify(v->get_outset());
-        delete v;
-      }
+      settle_vertex(v);
     }
   }
   
   void split(int nb, frontier& other) {
+    auto s = stats::on_enter_split();
     vertex* v = nullptr;
     vs.split([&] (int n) { return nb < n; }, v, other.vs);
     int vnb = v->nb_strands();
@@ -871,6 +928,7 @@ public:
       vs.push_front(sr.v1);
       other.vs.push_back(sr.v2);
     }
+    stats::on_exit_split(s);
 #if defined(ENCORE_ENABLE_LOGGING)
     int n2 = nb_strands();
     int n3 = other.nb_strands();
@@ -896,9 +954,11 @@ void worker_loop(vertex* v) {
   int my_id = data::perworker::get_my_id();
   frontier& my_ready = frontiers[my_id];
   std::atomic<frontier*>& my_transfer = transfers[my_id];
-  std::deque<vertex*>& my_suspended = suspended[my_id];
   std::unique_ptr<frontier> my_transfer_buf(new frontier);
+  machine::initialize_worker(my_id);
   fuel::initialize_worker();
+  stats::on_enter_worker();
+  elastic::on_enter_worker();
   
   if (v != nullptr) {
     // this worker is the leader
@@ -910,21 +970,19 @@ void worker_loop(vertex* v) {
     return my_ready.empty() && (my_transfer.load() == nullptr);
   };
 
-  auto is_my_pool_empty = [&] {
-    return is_my_ready_empty() && my_suspended.empty();
-  };
-  
   auto is_finished = [&] {
     return should_exit && is_my_ready_empty();
   };
       
-  // check for an incoming steal request
+  // check for an incoming steal request; a retiring worker offers its
+  // whole frontier
   auto communicate = [&] {
     if (data::perworker::get_nb_workers() == 1) {
       return;
     }
+    bool retiring = elastic::is_retiring();
     int nb_strands = my_ready.nb_strands();
-    if (nb_strands < 2) {
+    if (nb_strands < (retiring ? 1 : 2)) {
       return;
     }
     if (my_transfer.load() != nullptr) {
@@ -934,18 +992,17 @@ void worker_loop(vertex* v) {
     if (f == nullptr) {
       f = new frontier;
     }
-    my_ready.split(nb_strands / 2, *f);
+    if (retiring) {
+      f->swap(my_ready);
+    } else {
+      my_ready.split(nb_strands / 2, *f);
+    }
     my_transfer.store(f);
     logging::push_event(logging::worker_communicate);    
   };
   
   auto unblock = [&] {
-    if (my_suspended.empty()) {
-      return;
-    }
-    vertex* v = my_suspended.front();
-    my_suspended.pop_front();
-    run_vertex(v);
+    io::poll();
   };
 
   // called by workers when running out of work
@@ -955,7 +1012,8 @@ void worker_loop(vertex* v) {
     }
     assert(is_my_ready_empty());
     logging::push_event(logging::enter_wait);
-    while (! is_finished()) {
+    while ((! is_finished()) && (! elastic::should_retire())) {
+      machine::relax();
       int k = random_other_worker(my_id);
       std::atomic<frontier*>& transfer_k = transfers[k];
       frontier* orig = transfer_k.load();
@@ -978,11 +1036,19 @@ void worker_loop(vertex* v) {
   };
 
   while (! is_finished()) {
+    metrics::publisher::on_scheduler_loop(my_ready.nb_strands(), io::nb_pending.mine().load());
     frontier* f;
+    bool retiring = elastic::should_retire();
     if (my_ready.nb_strands() >= 1) {
       my_ready.run();
+    } else if (io::has_pending()) {
+      // the requests of this worker complete by unblock, below
     } else if (data::perworker::get_nb_workers() == 1) {
       break;
+    } else if (retiring) {
+      // the frontier left in the transfer slot, if any, goes to the
+      // thieves
+      elastic::park([&] { return should_exit; });
     } else if ((f = my_transfer.load()) != nullptr) {
       frontier* orig = f;
       if (my_transfer.compare_exchange_strong(orig, nullptr)) {
@@ -998,7 +1064,8 @@ void worker_loop(vertex* v) {
     communicate();
   }
 
-  assert(is_my_pool_empty());
+  assert(is_my_ready_empty());
+  stats::on_exit_worker();
   nb_running_workers--;
 }
   
@@ -1015,7 +1082,9 @@ void launch(int nb_workers, vertex* v) {
   }
   logging::push_event(logging::enter_algo);
   worker_loop(v);
-  while (nb_running_workers.load() > 0);
+  while (nb_running_workers.load() > 0) {
+    machine::relax();
+  }
   logging::push_event(logging::exit_algo);
 }
 
@@ -1044,13 +1113,8 @@ vertex* my_vertex() {
   
 void schedule(vertex* v) {
   assert(v->is_ready());
-  if (v->is_suspended) {
-    suspend(v);
-    return;
-  }
   if (v->nb_strands() == 0) {
-    parallel_notify(v->get_outset());
-    delete v;
+    finish_vertex(v);
     return;
   }
   if (scheduler == steal_half_work_stealing_tag) {
@@ -1105,12 +1169,14 @@ void release(vertex* v) {
   incounter::decrement(v->release_handle);
 }
   
-void suspend(vertex* v) {
-  suspended.mine().push_back(v);
-}
-  
-void parallel_notify(outset* out) {
+// notifies the successors of source, whose outset is out
+void parallel_notify(outset* out, vertex* source) {
   out->notify([&] (incounter_handle h) {
+#ifdef ENCORE_ENABLE_PROFILING
+    // the span must reach the destination before the decrement that may
+    // make the destination ready
+    profile::on_edge(source->span, h.get_vertex()->span);
+#endif
     incounter::decrement(h);
   });
 }
@@ -1,27 +1,137 @@
 #include <chrono>
 #include <map>
 #include <iostream>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <utility>
 
 #include "perworker.hpp"
+#include "cycles.hpp"
+#include "machine.hpp"
+#include "cmdline.hpp"
+#include "hwcounters.hpp"
 
 #ifndef _ENCORE_STATS_H_
 #define _ENCORE_STATS_H_
 
 namespace encore {
 
+/*---------------------------------------------------------------------*/
+/* Log-scale histogram
+ *
+ * Records durations, in cycles, in buckets whose width grows with the
+ * magnitude of the value: each power of two is split into four
+ * buckets, so that any percentile is reported within 25% of its exact
+ * value, in constant space.
+ */
+
+class log_histogram {
+private:
+  
+  static constexpr
+  int nb_sub_buckets = 4;
+  
+  static constexpr
+  int nb_buckets = 256;
+  
+  uint64_t buckets[nb_buckets];
+  
+  uint64_t nb = 0;
+  
+  uint64_t max = 0;
+  
+  static
+  int bucket_of(uint64_t v) {
+    if (v < nb_sub_buckets) {
+      return (int)v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    int sub = (int)((v >> (e - 2)) & (nb_sub_buckets - 1));
+    return nb_sub_buckets * (e - 1) + sub;
+  }
+  
+  // smallest value in bucket b
+  static
+  uint64_t lower_bound_of(int b) {
+    if (b < nb_sub_buckets) {
+      return (uint64_t)b;
+    }
+    int e = b / nb_sub_buckets + 1;
+    uint64_t sub = b % nb_sub_buckets;
+    return (nb_sub_buckets + sub) << (e - 2);
+  }
+  
+public:
+  
+  log_histogram() {
+    clear();
+  }
+  
+  void clear() {
+    std::fill(buckets, buckets + nb_buckets, 0);
+    nb = 0;
+    max = 0;
+  }
+  
+  void add(uint64_t v) {
+    buckets[bucket_of(v)]++;
+    nb++;
+    max = std::max(max, v);
+  }
+  
+  void merge(const log_histogram& other) {
+    for (int b = 0; b < nb_buckets; b++) {
+      buckets[b] += other.buckets[b];
+    }
+    nb += other.nb;
+    max = std::max(max, other.max);
+  }
+  
+  uint64_t size() const {
+    return nb;
+  }
+  
+  uint64_t get_max() const {
+    return max;
+  }
+  
+  // returns an upper bound on the p-th percentile, for 0 < p <= 100
+  uint64_t percentile(double p) const {
+    if (nb == 0) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil((p / 100.0) * nb);
+    rank = std::max((uint64_t)1, std::min(rank, nb));
+    uint64_t seen = 0;
+    for (int b = 0; b < nb_buckets; b++) {
+      seen += buckets[b];
+      if (seen >= rank) {
+        uint64_t upper = (b + 1 < nb_buckets) ? lower_bound_of(b + 1) - 1 : max;
+        return std::min(upper, max);
+      }
+    }
+    return max;
+  }
+  
+};
+
 template <bool enabled>
 class stats_base {
 public:
   
   using time_point_type = std::chrono::time_point<std::chrono::system_clock>;
   
-private:
-  
   using counter_id_type = enum {
     nb_promotions,
     nb_steals,
     nb_stacklet_allocations,
     nb_stacklet_deallocations,
+    nb_waits,
     nb_counters
   };
   
@@ -32,9 +142,12 @@ private:
     names[nb_steals] = "nb_steals";
     names[nb_stacklet_allocations] = "nb_stacklet_allocations";
     names[nb_stacklet_deallocations] = "nb_stacklet_deallocations";
+    names[nb_waits] = "nb_waits";
     return names[id];
   }
 
+private:
+
   using private_counters = struct {
     long counters[nb_counters];
   };
@@ -42,14 +155,47 @@ private:
   static
   data::perworker::array<private_counters> all_counters;
   
+  // the counters of a worker are written only by that worker, but are
+  // read concurrently by peek_counter, hence the relaxed atomic accesses
   static inline
   void increment(counter_id_type id) {
     if (! enabled) {
       return;
     }
-    all_counters.mine().counters[id]++;
+    long& c = all_counters.mine().counters[id];
+    __atomic_store_n(&c, __atomic_load_n(&c, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+  }
+  
+  using histogram_id_type = enum {
+    steal_latency,
+    inter_promotion,
+    split_duration,
+    idle_period,
+    nb_histograms
+  };
+  
+  static
+  const char* name_of_histogram(histogram_id_type id) {
+    switch (id) {
+      case steal_latency: return "steal_latency";
+      case inter_promotion: return "inter_promotion";
+      case split_duration: return "split_duration";
+      case idle_period: return "idle_period";
+      default: return "unknown";
+    }
   }
   
+  class private_histograms {
+  public:
+    log_histogram histograms[nb_histograms];
+    // in cycles, or zero if there is no such event yet
+    uint64_t enter_acquire = 0;
+    uint64_t last_promotion = 0;
+  };
+  
+  static
+  data::perworker::array<private_histograms> all_histograms;
+  
   static
   time_point_type enter_launch_time;
   
@@ -59,6 +205,77 @@ private:
   static
   data::perworker::array<double> all_total_idle_time;
   
+  // pairs of a time, in cycles, and of the number of active workers
+  // from that time on, recorded only in elastic mode
+  static
+  std::vector<std::pair<uint64_t, int>> active_workers_timeline;
+  
+  static
+  uint64_t exit_launch_cycles;
+  
+  class hw_record {
+  public:
+    hwcounters::group_type group;
+    hwcounters::snapshot_type enter_worker;
+    hwcounters::snapshot_type enter_acquire;
+    // counts over the lifetime of the worker, and over its calls to acquire
+    hwcounters::snapshot_type total;
+    hwcounters::snapshot_type acquire;
+  };
+  
+  static
+  bool hw_enabled;
+  
+  static
+  std::atomic<bool> hw_failed;
+  
+  static
+  data::perworker::array<hw_record> all_hw;
+  
+  static
+  void report_hw_line(const char* prefix, hwcounters::snapshot_type& t, hwcounters::snapshot_type& a) {
+    for (int i = 0; i < hwcounters::nb_counters; i++) {
+      const char* name = hwcounters::name_of((hwcounters::counter_id_type)i);
+      std::cout << prefix << name << " " << t.values[i] << std::endl;
+      std::cout << prefix << "acquire_" << name << " " << a.values[i] << std::endl;
+    }
+    uint64_t c = t.values[hwcounters::cycles];
+    double ipc = (c == 0) ? 0.0 : (double)t.values[hwcounters::instructions] / c;
+    std::cout << prefix << "ipc " << ipc << std::endl;
+  }
+  
+  // reports the active worker count over time, and returns its average
+  static
+  double report_active_workers() {
+    auto& t = active_workers_timeline;
+    uint64_t start = t.front().first;
+    double weighted = 0.0;
+    int min = t.front().second;
+    for (size_t i = 0; i < t.size(); i++) {
+      uint64_t end = (i + 1 < t.size()) ? t[i + 1].first : exit_launch_cycles;
+      weighted += (double)t[i].second * (double)(std::max(end, t[i].first) - t[i].first);
+      min = std::min(min, t[i].second);
+    }
+    uint64_t total = std::max(exit_launch_cycles, start) - start;
+    double avg = (total == 0) ? (double)t.front().second : weighted / total;
+    std::cout << "nb_active_workers_changes " << (t.size() - 1) << std::endl;
+    std::cout << "min_active_workers " << min << std::endl;
+    std::cout << "avg_active_workers " << avg << std::endl;
+    std::string fname = deepsea::cmdline::parse_or_default_string("active_workers_timeline", "");
+    if (fname != "") {
+      FILE* f = fopen(fname.c_str(), "w");
+      if (f == nullptr) {
+        fprintf(stderr, "warning: failed to open %s\n", fname.c_str());
+        return avg;
+      }
+      for (auto& p : t) {
+        fprintf(f, "%.6lf %d\n", machine::seconds_of_cycles(p.first - start), p.second);
+      }
+      fclose(f);
+    }
+    return avg;
+  }
+  
   static
   double since(time_point_type start) {
     auto end = std::chrono::system_clock::now();
@@ -70,12 +287,43 @@ public:
   
   static inline
   void on_promotion() {
+    if (! enabled) {
+      return;
+    }
     increment(nb_promotions);
+    private_histograms& h = all_histograms.mine();
+    auto now = cycles::now();
+    if (h.last_promotion != 0) {
+      h.histograms[inter_promotion].add(now - h.last_promotion);
+    }
+    h.last_promotion = now;
   }
   
+  // to be called by acquire, when a transfer succeeds
   static inline
   void on_steal() {
+    if (! enabled) {
+      return;
+    }
     increment(nb_steals);
+    private_histograms& h = all_histograms.mine();
+    h.histograms[steal_latency].add(cycles::since(h.enter_acquire));
+  }
+  
+  static inline
+  uint64_t on_enter_split() {
+    if (! enabled) {
+      return 0;
+    }
+    return cycles::now();
+  }
+  
+  static inline
+  void on_exit_split(uint64_t enter_split_time) {
+    if (! enabled) {
+      return;
+    }
+    all_histograms.mine().histograms[split_duration].add(cycles::since(enter_split_time));
   }
   
   static inline
@@ -88,30 +336,126 @@ public:
     increment(nb_stacklet_deallocations);
   }
   
+  // to be called when a vertex registers a wakeup (see vertex::wait)
+  static inline
+  void on_wait() {
+    increment(nb_waits);
+  }
+  
   static
   void on_enter_launch() {
     enter_launch_time = std::chrono::system_clock::now();
+    active_workers_timeline.clear();
   }
   
   static
   void on_exit_launch() {
     launch_duration = since(enter_launch_time);
+    exit_launch_cycles = cycles::now();
+  }
+  
+  // to be called each time the number of active workers changes; calls
+  // are to be serialized by the caller
+  static
+  void on_active_workers(int nb) {
+    if (! enabled) {
+      return;
+    }
+    active_workers_timeline.push_back(std::make_pair(cycles::now(), nb));
+  }
+  
+  // to be called by each worker thread, when it enters the scheduler loop
+  static
+  void on_enter_worker() {
+    if ((! enabled) || (! hw_enabled)) {
+      return;
+    }
+    hw_record& r = all_hw.mine();
+    if (! r.group.open()) {
+      if (! hw_failed.exchange(true)) {
+        fprintf(stderr, "warning: failed to open hardware performance counters\n");
+      }
+      return;
+    }
+    r.group.read(r.enter_worker);
+  }
+  
+  // to be called by each worker thread, when it leaves the scheduler loop
+  static
+  void on_exit_worker() {
+    if ((! enabled) || (! hw_enabled)) {
+      return;
+    }
+    hw_record& r = all_hw.mine();
+    if (! r.group.is_open()) {
+      return;
+    }
+    hwcounters::snapshot_type s;
+    r.group.read(s);
+    hwcounters::accumulate(r.total, r.enter_worker, s);
+    if (r.group.was_never_scheduled()) {
+      fprintf(stderr, "warning: the hardware performance counters of worker %d were never scheduled, and read as zero\n",
+              data::perworker::get_my_id());
+    }
+    r.group.close();
   }
   
   static
-  time_point_type on_enter_acquire() {
+  uint64_t on_enter_acquire() {
     if (! enabled) {
-      return time_point_type();
+      return 0;
     }
-    return std::chrono::system_clock::now();
+    if (hw_enabled) {
+      hw_record& r = all_hw.mine();
+      r.group.read(r.enter_acquire);
+    }
+    private_histograms& h = all_histograms.mine();
+    uint64_t now = cycles::now();
+    __atomic_store_n(&h.enter_acquire, now, __ATOMIC_RELAXED);
+    // time spent idle does not count toward the time between promotions
+    h.last_promotion = 0;
+    return now;
   }
   
   static
-  void on_exit_acquire(time_point_type enter_acquire_time) {
+  void on_exit_acquire(uint64_t enter_acquire_time) {
     if (! enabled) {
       return;
     }
-    all_total_idle_time.mine() += since(enter_acquire_time);
+    auto elapsed = cycles::since(enter_acquire_time);
+    double& idle_time = all_total_idle_time.mine();
+    double new_idle_time = idle_time + machine::seconds_of_cycles(elapsed);
+    __atomic_store(&idle_time, &new_idle_time, __ATOMIC_RELAXED);
+    private_histograms& h = all_histograms.mine();
+    h.histograms[idle_period].add(elapsed);
+    __atomic_store_n(&h.enter_acquire, (uint64_t)0, __ATOMIC_RELAXED);
+    if (hw_enabled) {
+      hw_record& r = all_hw.mine();
+      hwcounters::snapshot_type s;
+      r.group.read(s);
+      hwcounters::accumulate(r.acquire, r.enter_acquire, s);
+    }
+  }
+  
+  // the peek functions read the statistics of worker id while the
+  // worker may be updating them, and are meant for live monitoring only;
+  // the worker writes these statistics by relaxed atomic stores
+  
+  static
+  long peek_counter(int id, counter_id_type counter_id) {
+    return __atomic_load_n(&all_counters[id].counters[counter_id], __ATOMIC_RELAXED);
+  }
+  
+  // includes the ongoing idle period, if any
+  static
+  double peek_idle_time(int id) {
+    double idle_time;
+    __atomic_load(&all_total_idle_time[id], &idle_time, __ATOMIC_RELAXED);
+    uint64_t enter_acquire = __atomic_load_n(&all_histograms[id].enter_acquire, __ATOMIC_RELAXED);
+    if (enter_acquire != 0) {
+      idle_time += machine::seconds_of_cycles(cycles::since(enter_acquire));
+    }
+    return idle_time;
   }
   
   static
@@ -124,6 +468,22 @@ public:
     all_total_idle_time.for_each([&] (int, double& d) {
       d = 0.0;
     });
+    if (! enabled) {
+      return;
+    }
+    all_histograms.for_each([&] (int, private_histograms& h) {
+      for (int i = 0; i < nb_histograms; i++) {
+        h.histograms[i].clear();
+      }
+      h.enter_acquire = 0;
+      h.last_promotion = 0;
+    });
+    hw_enabled = deepsea::cmdline::parse_or_default_bool("perf_counters", false);
+    hw_failed.store(false);
+    all_hw.for_each([&] (int, hw_record& r) {
+      hwcounters::clear(r.total);
+      hwcounters::clear(r.acquire);
+    });
   }
   
   static
@@ -141,6 +501,10 @@ public:
     }
     std::cout << "launch_duration " << launch_duration << std::endl;
     double cumulated_time = launch_duration * data::perworker::get_nb_workers();
+    if (! active_workers_timeline.empty()) {
+      // idle time is relative to the time during which workers were active
+      cumulated_time = launch_duration * report_active_workers();
+    }
     double total_idle_time = 0.0;
     all_total_idle_time.for_each([&] (int, double& d) {
       total_idle_time += d;
@@ -149,6 +513,33 @@ public:
     double utilization = 1.0 - relative_idle;
     std::cout << "total_idle_time " << total_idle_time << std::endl;
     std::cout << "utilization " << utilization << std::endl;
+    for (int i = 0; i < nb_histograms; i++) {
+      log_histogram h;
+      all_histograms.for_each([&] (int, private_histograms& p) {
+        h.merge(p.histograms[i]);
+      });
+      std::string name = name_of_histogram((histogram_id_type)i);
+      std::cout << "nb_" << name << " " << h.size() << std::endl;
+      for (double p : { 50.0, 90.0, 99.0, 99.9 }) {
+        std::cout << name << "_usec_p" << p << " " << machine::microseconds_of_cycles(h.percentile(p)) << std::endl;
+      }
+      std::cout << name << "_usec_max " << machine::microseconds_of_cycles(h.get_max()) << std::endl;
+    }
+    if (hw_enabled) {
+      hwcounters::snapshot_type total, acquire;
+      hwcounters::clear(total);
+      hwcounters::clear(acquire);
+      for (int id = 0; id < data::perworker::get_nb_workers(); id++) {
+        hw_record& r = all_hw[id];
+        for (int i = 0; i < hwcounters::nb_counters; i++) {
+          total.values[i] += r.total.values[i];
+          acquire.values[i] += r.acquire.values[i];
+        }
+        std::string prefix = "worker_" + std::to_string(id) + "_hw_";
+        report_hw_line(prefix.c_str(), r.total, r.acquire);
+      }
+      report_hw_line("hw_", total, acquire);
+    }
   }
   
 };
@@ -165,6 +556,24 @@ double stats_base<enabled>::launch_duration;
 template <bool enabled>
 data::perworker::array<double> stats_base<enabled>::all_total_idle_time;
   
+template <bool enabled>
+std::vector<std::pair<uint64_t, int>> stats_base<enabled>::active_workers_timeline;
+  
+template <bool enabled>
+uint64_t stats_base<enabled>::exit_launch_cycles = 0;
+  
+template <bool enabled>
+data::perworker::array<typename stats_base<enabled>::private_histograms> stats_base<enabled>::all_histograms;
+  
+template <bool enabled>
+bool stats_base<enabled>::hw_enabled = false;
+  
+template <bool enabled>
+std::atomic<bool> stats_base<enabled>::hw_failed;
+  
+template <bool enabled>
+data::perworker::array<typename stats_base<enabled>::hw_record> stats_base<enabled>::all_hw;
+  
 #ifdef ENCORE_ENABLE_STATS
 using stats = stats_base<true>;
 #else
@@ -5,6 +5,7 @@
 #include "incounter.hpp"
 #include "outset.hpp"
 #include "fuel.hpp"
+#include "profile.hpp"
 
 #ifndef _ENCORE_SCHED_VERTEX_H_
 #define _ENCORE_SCHED_VERTEX_H_
@@ -17,7 +18,12 @@ public:
   
   incounter_handle release_handle;
   
-  bool is_suspended = false;
+  // set by run() to have the scheduler call wait() once run() returns
+  bool is_waiting = false;
+  
+#ifdef ENCORE_ENABLE_PROFILING
+  profile::span_record span;
+#endif
   
 private:
   
@@ -63,6 +69,15 @@ public:
   virtual
   vertex_split_type split(int nb) = 0;
   
+  // registers the vertex to be scheduled once the event that it waits
+  // for occurs, and returns true, or returns false if the event has
+  // occurred already; the vertex is not to be scheduled otherwise, so
+  // that it runs again exactly once per event
+  virtual
+  bool wait() {
+    return false;
+  }
+  
 };
   
 // invariant 1: each vertex is ready (incounter is zero)
@@ -0,0 +1,356 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <functional>
+
+#include "dagfile.hpp"
+
+/*---------------------------------------------------------------------*/
+/* Offline scheduling simulator for the DAGs that are recorded by an
+ * encore program that was launched with -dag_record <file>
+ *
+ * usage: dagsim <file> [-proc P1,P2,...] [-policy greedy|steal_one|steal_half|all]
+ *               [-steal_cycles N] [-seed S]
+ *
+ * For each number of processors P and each policy, the simulator
+ * predicts the makespan of the DAG, along with the resulting speedup
+ * and utilization. Greedy is the idealized list scheduler, which never
+ * leaves a processor idle while some node is ready. The work-stealing
+ * policies model per-worker deques, where an idle worker pays
+ * steal_cycles for each attempt to steal from a random victim, and
+ * takes either one node (steal_one) or half of the nodes (steal_half)
+ * of the victim.
+ *
+ * The recorded DAG reflects the promotions of the recorded run: it is
+ * most faithful to the heartbeat scheduler when the recorded run used
+ * a comparable promotion threshold.
+ */
+
+namespace dagfile = encore::dagfile;
+
+using node_id_type = uint64_t;
+
+class dag_type {
+public:
+  uint64_t nb_ids = 0;
+  double cpu_frequency_ghz = 1.0;
+  uint64_t nb_workers = 0;
+  std::vector<uint64_t> work;
+  std::vector<bool> used;
+  // outgoing edges, in compressed sparse row format
+  std::vector<uint64_t> offsets;
+  std::vector<node_id_type> targets;
+  std::vector<uint64_t> indegree;
+  uint64_t total_work = 0;
+  uint64_t span = 0;
+  uint64_t nb_nodes = 0;
+  uint64_t nb_edges = 0;
+};
+
+void die(const char* msg, const char* arg) {
+  fprintf(stderr, msg, arg);
+  exit(1);
+}
+
+void load(const char* fname, dag_type& dag) {
+  FILE* f = fopen(fname, "r");
+  if (f == nullptr) {
+    die("failed to open %s\n", fname);
+  }
+  dagfile::header_type h;
+  if ((fread(&h, sizeof(h), 1, f) != 1) || (h.magic != dagfile::magic)) {
+    die("bogus dag file %s\n", fname);
+  }
+  dag.nb_ids = h.nb_ids;
+  dag.cpu_frequency_ghz = h.cpu_frequency_ghz;
+  dag.nb_workers = h.nb_workers;
+  dag.work.assign(h.nb_ids, 0);
+  dag.used.assign(h.nb_ids, false);
+  std::vector<dagfile::node_type> nodes(h.nb_nodes);
+  std::vector<dagfile::edge_type> edges(h.nb_edges);
+  if ((fread(nodes.data(), sizeof(dagfile::node_type), h.nb_nodes, f) != h.nb_nodes) ||
+      (fread(edges.data(), sizeof(dagfile::edge_type), h.nb_edges, f) != h.nb_edges)) {
+    die("truncated dag file %s\n", fname);
+  }
+  fclose(f);
+  for (auto& n : nodes) {
+    if (n.id >= h.nb_ids) {
+      die("bogus node in %s\n", fname);
+    }
+    dag.work[n.id] += n.work;
+    dag.used[n.id] = true;
+    dag.total_work += n.work;
+  }
+  dag.offsets.assign(h.nb_ids + 1, 0);
+  dag.indegree.assign(h.nb_ids, 0);
+  for (auto& e : edges) {
+    if ((e.src >= h.nb_ids) || (e.dst >= h.nb_ids)) {
+      die("bogus edge in %s\n", fname);
+    }
+    if ((! dag.used[e.src]) || (! dag.used[e.dst])) {
+      die("edge between nodes that are not recorded in %s\n", fname);
+    }
+    dag.offsets[e.src + 1]++;
+    dag.indegree[e.dst]++;
+  }
+  for (uint64_t i = 0; i < h.nb_ids; i++) {
+    dag.offsets[i + 1] += dag.offsets[i];
+  }
+  dag.targets.resize(h.nb_edges);
+  std::vector<uint64_t> pos(dag.offsets.begin(), dag.offsets.end() - 1);
+  for (auto& e : edges) {
+    dag.targets[pos[e.src]++] = e.dst;
+  }
+  dag.nb_edges = h.nb_edges;
+  dag.nb_nodes = std::count(dag.used.begin(), dag.used.end(), true);
+  // span: longest path, in topological order
+  std::vector<uint64_t> indegree = dag.indegree;
+  std::vector<uint64_t> finish(h.nb_ids, 0);
+  std::vector<node_id_type> todo;
+  for (node_id_type n = 0; n < h.nb_ids; n++) {
+    if (dag.used[n] && (indegree[n] == 0)) {
+      todo.push_back(n);
+    }
+  }
+  uint64_t nb_visited = 0;
+  while (! todo.empty()) {
+    node_id_type n = todo.back();
+    todo.pop_back();
+    nb_visited++;
+    finish[n] += dag.work[n];
+    dag.span = std::max(dag.span, finish[n]);
+    for (uint64_t i = dag.offsets[n]; i < dag.offsets[n + 1]; i++) {
+      node_id_type m = dag.targets[i];
+      finish[m] = std::max(finish[m], finish[n]);
+      if (--indegree[m] == 0) {
+        todo.push_back(m);
+      }
+    }
+  }
+  if (nb_visited != dag.nb_nodes) {
+    die("dag in %s has a cycle\n", fname);
+  }
+}
+
+class result_type {
+public:
+  uint64_t makespan = 0;
+  uint64_t nb_steals = 0;
+  uint64_t nb_steal_attempts = 0;
+};
+
+/*---------------------------------------------------------------------*/
+/* Greedy list scheduling */
+
+result_type simulate_greedy(const dag_type& dag, int nb_proc) {
+  result_type r;
+  std::vector<uint64_t> indegree = dag.indegree;
+  std::vector<node_id_type> ready;
+  for (node_id_type n = 0; n < dag.nb_ids; n++) {
+    if (dag.used[n] && (indegree[n] == 0)) {
+      ready.push_back(n);
+    }
+  }
+  using event_type = std::pair<uint64_t, node_id_type>;
+  std::priority_queue<event_type, std::vector<event_type>, std::greater<event_type>> running;
+  uint64_t now = 0;
+  while ((! ready.empty()) || (! running.empty())) {
+    while ((! ready.empty()) && (running.size() < nb_proc)) {
+      node_id_type n = ready.back();
+      ready.pop_back();
+      running.push(std::make_pair(now + dag.work[n], n));
+    }
+    auto e = running.top();
+    running.pop();
+    now = e.first;
+    node_id_type n = e.second;
+    for (uint64_t i = dag.offsets[n]; i < dag.offsets[n + 1]; i++) {
+      node_id_type m = dag.targets[i];
+      if (--indegree[m] == 0) {
+        ready.push_back(m);
+      }
+    }
+  }
+  r.makespan = now;
+  return r;
+}
+
+/*---------------------------------------------------------------------*/
+/* Work stealing */
+
+result_type simulate_work_stealing(const dag_type& dag, int nb_proc, bool steal_half,
+                                   uint64_t steal_cycles, unsigned seed) {
+  result_type r;
+  std::mt19937 rng(seed);
+  std::vector<uint64_t> indegree = dag.indegree;
+  std::vector<std::deque<node_id_type>> deques(nb_proc);
+  uint64_t nb_remaining = dag.nb_nodes;
+  // the node run by each worker, or ~0 if the worker is stealing
+  static constexpr
+  node_id_type no_node = ~(node_id_type)0;
+  std::vector<node_id_type> running(nb_proc, no_node);
+  // workers whose last steal attempt found no ready node anywhere
+  std::vector<int> parked;
+  uint64_t nb_ready = 0;
+  for (node_id_type n = 0; n < dag.nb_ids; n++) {
+    if (dag.used[n] && (indegree[n] == 0)) {
+      deques[0].push_back(n);
+      nb_ready++;
+    }
+  }
+  using event_type = std::pair<uint64_t, int>;
+  std::priority_queue<event_type, std::vector<event_type>, std::greater<event_type>> events;
+  for (int p = 0; p < nb_proc; p++) {
+    events.push(std::make_pair(0, p));
+  }
+  uint64_t now = 0;
+  auto unpark = [&] {
+    for (int p : parked) {
+      events.push(std::make_pair(now + steal_cycles, p));
+    }
+    parked.clear();
+  };
+  while (nb_remaining > 0) {
+    auto e = events.top();
+    events.pop();
+    now = e.first;
+    int p = e.second;
+    std::deque<node_id_type>& my_deque = deques[p];
+    if (running[p] != no_node) {
+      node_id_type n = running[p];
+      running[p] = no_node;
+      nb_remaining--;
+      bool pushed = false;
+      for (uint64_t i = dag.offsets[n]; i < dag.offsets[n + 1]; i++) {
+        node_id_type m = dag.targets[i];
+        if (--indegree[m] == 0) {
+          my_deque.push_back(m);
+          nb_ready++;
+          pushed = true;
+        }
+      }
+      if (pushed) {
+        unpark();
+      }
+    } else if (my_deque.empty() && (nb_proc > 1)) {
+      // the steal attempt that was started steal_cycles ago completes now
+      int k = std::uniform_int_distribution<int>(0, nb_proc - 2)(rng);
+      if (k >= p) {
+        k++;
+      }
+      std::deque<node_id_type>& victim = deques[k];
+      r.nb_steal_attempts++;
+      if (! victim.empty()) {
+        size_t nb = steal_half ? (victim.size() + 1) / 2 : 1;
+        for (size_t i = 0; i < nb; i++) {
+          my_deque.push_back(victim.front());
+          victim.pop_front();
+        }
+        r.nb_steals++;
+      }
+    }
+    if (! my_deque.empty()) {
+      node_id_type n = my_deque.back();
+      my_deque.pop_back();
+      nb_ready--;
+      running[p] = n;
+      events.push(std::make_pair(now + dag.work[n], p));
+    } else if (nb_ready == 0) {
+      parked.push_back(p);
+    } else {
+      events.push(std::make_pair(now + steal_cycles, p));
+    }
+  }
+  r.makespan = now;
+  return r;
+}
+
+/*---------------------------------------------------------------------*/
+
+std::vector<int> parse_procs(const std::string& s) {
+  std::vector<int> procs;
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos) {
+      end = s.size();
+    }
+    procs.push_back(std::max(1, atoi(s.substr(start, end - start).c_str())));
+    start = end + 1;
+  }
+  return procs;
+}
+
+void report(const dag_type& dag, const char* policy, int nb_proc, const result_type& r) {
+  double cycles_per_sec = dag.cpu_frequency_ghz * 1000000000.0;
+  double speedup = (r.makespan == 0) ? 0.0 : (double)dag.total_work / r.makespan;
+  double utilization = speedup / nb_proc;
+  printf("policy %s\n", policy);
+  printf("proc %d\n", nb_proc);
+  printf("makespan_cycles %lu\n", (unsigned long)r.makespan);
+  printf("exectime %.6lf\n", r.makespan / cycles_per_sec);
+  printf("speedup %.3lf\n", speedup);
+  printf("utilization %.4lf\n", utilization);
+  printf("overhead %.4lf\n", 1.0 - utilization);
+  if (r.nb_steal_attempts > 0) {
+    printf("nb_steals %lu\n", (unsigned long)r.nb_steals);
+    printf("nb_steal_attempts %lu\n", (unsigned long)r.nb_steal_attempts);
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file> [-proc P1,P2,...] [-policy greedy|steal_one|steal_half|all] "
+                    "[-steal_cycles N] [-seed S]\n", argv[0]);
+    return 1;
+  }
+  const char* fname = argv[1];
+  std::string procs_arg = "1";
+  std::string policy = "all";
+  uint64_t steal_cycles = 2000;
+  unsigned seed = 1;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    std::string key = argv[i];
+    std::string value = argv[i + 1];
+    if (key == "-proc") {
+      procs_arg = value;
+    } else if (key == "-policy") {
+      policy = value;
+    } else if (key == "-steal_cycles") {
+      steal_cycles = strtoull(value.c_str(), nullptr, 10);
+    } else if (key == "-seed") {
+      seed = (unsigned)atoi(value.c_str());
+    } else {
+      die("unknown option %s\n", key.c_str());
+    }
+  }
+  dag_type dag;
+  load(fname, dag);
+  double cycles_per_sec = dag.cpu_frequency_ghz * 1000000000.0;
+  printf("nb_nodes %lu\n", (unsigned long)dag.nb_nodes);
+  printf("nb_edges %lu\n", (unsigned long)dag.nb_edges);
+  printf("recorded_nb_workers %lu\n", (unsigned long)dag.nb_workers);
+  printf("work %.6lf\n", dag.total_work / cycles_per_sec);
+  printf("span %.6lf\n", dag.span / cycles_per_sec);
+  printf("parallelism %.3lf\n\n", (dag.span == 0) ? 0.0 : (double)dag.total_work / dag.span);
+  for (int p : parse_procs(procs_arg)) {
+    if ((policy == "greedy") || (policy == "all")) {
+      report(dag, "greedy", p, simulate_greedy(dag, p));
+    }
+    if ((policy == "steal_one") || (policy == "all")) {
+      report(dag, "steal_one", p, simulate_work_stealing(dag, p, false, steal_cycles, seed));
+    }
+    if ((policy == "steal_half") || (policy == "all")) {
+      report(dag, "steal_half", p, simulate_work_stealing(dag, p, true, steal_cycles, seed));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "metricsshm.hpp"
+
+/*---------------------------------------------------------------------*/
+/* Live view of the metrics published by an encore program that was
+ * launched with -metrics_shm <name>
+ *
+ * usage: encore-top <name> [refresh_ms]
+ *
+ * The view ends once the program publishes its last snapshot, or, if
+ * the program dies before that, once the publishing process is gone or
+ * has not published for stall_timeout_intervals of its intervals.
+ */
+
+namespace metrics = encore::metrics;
+
+using snapshot_type = struct {
+  std::vector<char> header;
+  std::vector<metrics::worker_record_type> workers;
+};
+
+metrics::segment_header_type* header_of(snapshot_type& s) {
+  return (metrics::segment_header_type*)s.header.data();
+}
+
+static constexpr
+int stall_timeout_intervals = 50;
+
+static constexpr
+int min_stall_timeout_ms = 2000;
+
+static constexpr
+int retry_sleep_us = 200;
+
+using clock_type = std::chrono::steady_clock;
+
+// copies a consistent snapshot of the segment, following the sequence
+// lock; returns false if no consistent copy could be taken within
+// timeout_ms, e.g., because the publisher died while it held the lock
+bool read_snapshot(metrics::segment_header_type* segment, snapshot_type& s, int timeout_ms) {
+  auto nb_workers = segment->nb_workers;
+  s.header.resize(sizeof(metrics::segment_header_type));
+  s.workers.resize(nb_workers);
+  auto start = clock_type::now();
+  while (true) {
+    uint64_t seq1 = segment->seq.load();
+    if (seq1 % 2 == 0) {
+      memcpy(s.header.data(), (void*)segment, sizeof(metrics::segment_header_type));
+      memcpy((void*)s.workers.data(), metrics::workers_of(segment),
+             nb_workers * sizeof(metrics::worker_record_type));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (segment->seq.load() == seq1) {
+        return true;
+      }
+    }
+    if (clock_type::now() - start > std::chrono::milliseconds(timeout_ms)) {
+      return false;
+    }
+    // the publisher holds the lock only for the time of a copy; the
+    // host may be busy with the very program that is observed
+    std::this_thread::sleep_for(std::chrono::microseconds(retry_sleep_us));
+  }
+}
+
+bool is_alive(pid_t pid) {
+  return (kill(pid, 0) == 0) || (errno == EPERM);
+}
+
+void print(snapshot_type& prev, snapshot_type& cur) {
+  auto h = header_of(cur);
+  double dt = h->elapsed - header_of(prev)->elapsed;
+  printf("\033[H\033[2J");
+  printf("elapsed %.3lf s\tworkers %lu\tpublications %lu\n\n",
+         h->elapsed, (unsigned long)h->nb_workers, (unsigned long)h->nb_publications);
+  printf("worker\tutil\tready\tpending_io");
+  for (int i = 0; i < h->nb_counters; i++) {
+    printf("\t%s", h->counter_names[i]);
+  }
+  printf("\n");
+  double total_util = 0.0;
+  for (int id = 0; id < h->nb_workers; id++) {
+    auto& w = cur.workers[id];
+    double didle = w.idle_time - prev.workers[id].idle_time;
+    double util = (dt > 0.0) ? 1.0 - (didle / dt) : 0.0;
+    util = std::max(0.0, std::min(1.0, util));
+    total_util += util;
+    printf("%d\t%.2lf\t%ld\t%ld", id, util, (long)w.nb_ready, (long)w.nb_pending_io);
+    for (int i = 0; i < h->nb_counters; i++) {
+      printf("\t%ld", (long)w.counters[i]);
+    }
+    printf("\n");
+  }
+  printf("\nutilization %.2lf\n", (h->nb_workers == 0) ? 0.0 : total_util / h->nb_workers);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <name> [refresh_ms]\n", argv[0]);
+    return 1;
+  }
+  const char* name = argv[1];
+  int refresh_ms = (argc >= 3) ? atoi(argv[2]) : 500;
+  int fd = -1;
+  while ((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(refresh_ms));
+  }
+  struct stat st;
+  while ((fstat(fd, &st) == 0) && (st.st_size < sizeof(metrics::segment_header_type))) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "failed to map %s\n", name);
+    return 1;
+  }
+  auto segment = (metrics::segment_header_type*)p;
+  while (segment->magic != metrics::segment_magic) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (metrics::segment_size(segment->nb_workers) > st.st_size) {
+    fprintf(stderr, "bogus segment %s\n", name);
+    return 1;
+  }
+  pid_t pid = (pid_t)segment->pid;
+  int timeout_ms = std::max(min_stall_timeout_ms,
+                            stall_timeout_intervals * (int)segment->interval_ms);
+  snapshot_type prev, cur;
+  int status = 0;
+  if (! read_snapshot(segment, prev, timeout_ms)) {
+    fprintf(stderr, "%s is not being published\n", name);
+    munmap(p, st.st_size);
+    return 1;
+  }
+  auto last_progress = clock_type::now();
+  while (! header_of(prev)->finished) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(refresh_ms));
+    if (read_snapshot(segment, cur, timeout_ms)) {
+      bool progress = (header_of(cur)->nb_publications != header_of(prev)->nb_publications);
+      print(prev, cur);
+      std::swap(prev, cur);
+      if (progress) {
+        last_progress = clock_type::now();
+        continue;
+      }
+    }
+    if (! is_alive(pid)) {
+      fprintf(stderr, "process %d, which published %s, is gone\n", (int)pid, name);
+      status = 1;
+      break;
+    }
+    if (clock_type::now() - last_progress > std::chrono::milliseconds(timeout_ms)) {
+      fprintf(stderr, "%s has not been published for %d ms\n", name, timeout_ms);
+      status = 1;
+      break;
+    }
+  }
+  munmap(p, st.st_size);
+  return status;
+}